@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Mesh.h"
+
+// Planes a triangle can be clipped against, combined into a mask for Clip_Polygon
+enum CLIP_PLANE : uint32_t
+{
+	CLIP_NEAR = 1,
+	CLIP_LEFT = 2,
+	CLIP_RIGHT = 4,
+	CLIP_TOP = 8,
+	CLIP_BOTTOM = 16,
+	CLIP_FAR = 32,
+	CLIP_SCREEN = CLIP_LEFT | CLIP_RIGHT | CLIP_TOP | CLIP_BOTTOM,
+	CLIP_ALL = CLIP_NEAR | CLIP_SCREEN | CLIP_FAR
+};
+
+// Where the planes are. Positions are in clip space, from a matrix that ends
+// with the viewport (see Matrix_Viewport), so the edge planes are in console
+// cells: a point is kept when fLeft <= x / w <= fRight and fTop <= y / w <=
+// fBottom. w is the view space depth, which is what fNear and fFar are
+// compared with
+struct clipBounds
+{
+	float fNear, fFar;
+	float fLeft, fTop, fRight, fBottom;
+};
+
+// A convex polygon in clip space. Each plane adds at most one corner to a
+// triangle, so six planes leave at most nine
+struct clipPolygon
+{
+	static const int MAX_VERTS = 9;
+	vec3d p[MAX_VERTS];
+	int nVerts = 0;
+};
+
+// Signed distance of a clip space position from one of the planes, not
+// normalised but positive on the inside and linear in the position, which is
+// all Sutherland-Hodgman needs to find where an edge crosses
+inline float Clip_Distance(uint32_t plane, const vec3d& v, const clipBounds& b)
+{
+	switch (plane)
+	{
+	case CLIP_NEAR:		return v.w - b.fNear;
+	case CLIP_LEFT:		return v.x - b.fLeft * v.w;
+	case CLIP_RIGHT:	return b.fRight * v.w - v.x;
+	case CLIP_TOP:		return v.y - b.fTop * v.w;
+	case CLIP_BOTTOM:	return b.fBottom * v.w - v.y;
+	default:			return b.fFar - v.w;
+	}
+}
+
+// Clip a triangle with clip space corners against every plane in the mask at
+// once (Sutherland-Hodgman), leaving the convex polygon that is inside all of
+// them in out. The polygon is passed from plane to plane in two arrays on the
+// stack, and planes that no corner is outside of are skipped. Returns the
+// number of corners, 0 if nothing is left. Clipping in clip space rather than
+// view space is exact because the projection is linear until the divide by w
+inline int Clip_Polygon(const triangle& tri, uint32_t planes, const clipBounds& b, clipPolygon& out)
+{
+	vec3d buf[2][clipPolygon::MAX_VERTS];
+	vec3d* pIn = buf[0];
+	vec3d* pOut = buf[1];
+	int nIn = 3;
+	pIn[0] = tri.p[0];
+	pIn[1] = tri.p[1];
+	pIn[2] = tri.p[2];
+
+	for (uint32_t plane = CLIP_NEAR; plane <= CLIP_FAR; plane <<= 1)
+	{
+		if (!(planes & plane))
+			continue;
+
+		float dist[clipPolygon::MAX_VERTS];
+		bool bAnyOutside = false;
+		for (int i = 0; i < nIn; i++)
+		{
+			dist[i] = Clip_Distance(plane, pIn[i], b);
+			bAnyOutside |= dist[i] < 0.0f;
+		}
+		if (!bAnyOutside)
+			continue;
+
+		// Walk the edges, keeping corners on the inside and adding a corner
+		// wherever an edge crosses the plane
+		int nOut = 0;
+		for (int i = 0; i < nIn; i++)
+		{
+			int j = i + 1 < nIn ? i + 1 : 0;
+			bool bInsideI = dist[i] >= 0.0f;
+			bool bInsideJ = dist[j] >= 0.0f;
+			if (bInsideI)
+				pOut[nOut++] = pIn[i];
+			if (bInsideI != bInsideJ)
+			{
+				float t = dist[i] / (dist[i] - dist[j]);
+				const vec3d& a = pIn[i];
+				const vec3d& c = pIn[j];
+				pOut[nOut++] = { a.x + (c.x - a.x) * t, a.y + (c.y - a.y) * t, a.z + (c.z - a.z) * t, a.w + (c.w - a.w) * t };
+			}
+		}
+
+		vec3d* pSwap = pIn; pIn = pOut; pOut = pSwap;
+		nIn = nOut;
+		if (nIn < 3)
+			return out.nVerts = 0;
+	}
+
+	for (int i = 0; i < nIn; i++)
+		out.p[i] = pIn[i];
+	return out.nVerts = nIn;
+}
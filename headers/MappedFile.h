@@ -0,0 +1,162 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. The contents are paged in by the OS
+// on demand, so nothing is copied into our own buffers while parsing
+class MappedFile
+{
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			m_pData = other.m_pData;
+			m_nSize = other.m_nSize;
+#ifdef _WIN32
+			m_hFile = other.m_hFile;
+			m_hMapping = other.m_hMapping;
+			other.m_hFile = INVALID_HANDLE_VALUE;
+			other.m_hMapping = NULL;
+#endif
+			other.m_pData = nullptr;
+			other.m_nSize = 0;
+		}
+		return *this;
+	}
+
+	~MappedFile() { Close(); }
+
+	bool Open(const std::string& filename)
+	{
+		Close();
+#ifdef _WIN32
+		m_hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_hFile, &size))
+		{
+			Close();
+			return false;
+		}
+		m_nSize = (size_t)size.QuadPart;
+
+		// An empty file can't be mapped, but it is still a valid (empty) file
+		if (m_nSize == 0)
+			return true;
+
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping == NULL)
+		{
+			Close();
+			return false;
+		}
+
+		m_pData = (const char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_pData == nullptr)
+		{
+			Close();
+			return false;
+		}
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			close(fd);
+			return false;
+		}
+		m_nSize = (size_t)st.st_size;
+
+		if (m_nSize > 0)
+		{
+			void* p = mmap(nullptr, m_nSize, PROT_READ, MAP_SHARED, fd, 0);
+			if (p == MAP_FAILED)
+			{
+				close(fd);
+				m_nSize = 0;
+				return false;
+			}
+			madvise(p, m_nSize, MADV_SEQUENTIAL);
+			m_pData = (const char*)p;
+		}
+
+		// The mapping stays valid after the descriptor is closed
+		close(fd);
+#endif
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_pData)
+			UnmapViewOfFile(m_pData);
+		if (m_hMapping != NULL)
+			CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+		m_hMapping = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		if (m_pData)
+			munmap((void*)m_pData, m_nSize);
+#endif
+		m_pData = nullptr;
+		m_nSize = 0;
+	}
+
+	const char* Data() const { return m_pData; }
+	size_t Size() const { return m_nSize; }
+
+private:
+	const char* m_pData = nullptr;
+	size_t m_nSize = 0;
+#ifdef _WIN32
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = NULL;
+#endif
+};
+
+// Size and last modification time of a file, used to tell whether a file
+// derived from it (eg: a baked mesh cache) is still up to date
+inline bool GetFileStamp(const std::string& filename, uint64_t& size, uint64_t& mtime)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data))
+		return false;
+	size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	mtime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	size = (uint64_t)st.st_size;
+	mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
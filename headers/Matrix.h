@@ -2,25 +2,57 @@
 
 #include"Mesh.h"
 #include"Vector.h"
+#include"Simd.h"
+#include<type_traits>
 #define MAX(a,b) ((a) > (b)? (a) : (b))
 
+// What a matrix is known to do, from the most to the least special. Rigid
+// matrices only rotate, mirror and translate. Affine ones may also scale and
+// shear, and both keep 0, 0, 0, 1 as their last column. Projective ones may
+// use all 16 entries
+enum class matrixKind { Rigid, Affine, Projective };
+
+// A mat4x4 tagged with its kind, so composition and inversion can skip the
+// entries that are known to be 0 or 1, and the rigid only inverse can't be
+// given anything else
+template<matrixKind K>
+struct transform : mat4x4
+{
+	transform() {}
+
+	// A matrix of a more special kind is also one of every more general kind
+	template<matrixKind K2, class = typename std::enable_if<(K2 < K)>::type>
+	transform(const transform<K2>& m) : mat4x4(m) {}
+
+	// Tagging a plain mat4x4 has to be asked for, the caller vouches for its kind
+	explicit transform(const mat4x4& m) : mat4x4(m) {}
+};
+
+typedef transform<matrixKind::Rigid> matRigid;
+typedef transform<matrixKind::Affine> matAffine;
+typedef transform<matrixKind::Projective> matProjective;
+
 class Matrix : protected Vector
 {
 protected:
 	
-	vec3d Matrix_MultiplyVector(mat4x4& m, vec3d& i)
+	vec3d Matrix_MultiplyVector(const mat4x4& m, const vec3d& i)
 	{
+#if HAMRO_SIMD
+		return simd::Store(simd::MultiplyRows(simd::Load(i), m));
+#else
 		vec3d v;
 		v.x = i.x * m.m[0][0] + i.y * m.m[1][0] + i.z * m.m[2][0] + i.w * m.m[3][0];
 		v.y = i.x * m.m[0][1] + i.y * m.m[1][1] + i.z * m.m[2][1] + i.w * m.m[3][1];
 		v.z = i.x * m.m[0][2] + i.y * m.m[1][2] + i.z * m.m[2][2] + i.w * m.m[3][2];
 		v.w = i.x * m.m[0][3] + i.y * m.m[1][3] + i.z * m.m[2][3] + i.w * m.m[3][3];
 		return v;
+#endif
 	}
 
-	mat4x4 Matrix_Identity()
+	matRigid Matrix_Identity()
 	{
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = 1.0f;
 		matrix.m[1][1] = 1.0f;
 		matrix.m[2][2] = 1.0f;
@@ -28,9 +60,9 @@ protected:
 		return matrix;
 	}
 
-	mat4x4 Matrix_RotationX(float fAngleRad)
+	matRigid Matrix_RotationX(float fAngleRad)
 	{
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = 1.0f;
 		matrix.m[1][1] = cosf(fAngleRad);
 		matrix.m[1][2] = sinf(fAngleRad);
@@ -40,9 +72,9 @@ protected:
 		return matrix;
 	}
 
-	mat4x4 Matrix_RotationY(float fAngleRad)
+	matRigid Matrix_RotationY(float fAngleRad)
 	{
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = cosf(fAngleRad);
 		matrix.m[0][2] = sinf(fAngleRad);
 		matrix.m[2][0] = -sinf(fAngleRad);
@@ -52,9 +84,9 @@ protected:
 		return matrix;
 	}
 
-	mat4x4 Matrix_RotationZ(float fAngleRad)
+	matRigid Matrix_RotationZ(float fAngleRad)
 	{
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = cosf(fAngleRad);
 		matrix.m[0][1] = sinf(fAngleRad);
 		matrix.m[1][0] = -sinf(fAngleRad);
@@ -64,9 +96,9 @@ protected:
 		return matrix;
 	}
 
-	mat4x4 Matrix_Translation(float x, float y, float z)
+	matRigid Matrix_Translation(float x, float y, float z)
 	{
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = 1.0f;
 		matrix.m[1][1] = 1.0f;
 		matrix.m[2][2] = 1.0f;
@@ -77,10 +109,10 @@ protected:
 		return matrix;
 	}
 
-	mat4x4 Matrix_Projection(float fFovDegrees, float fAspectRatio, float fNear, float fFar)
+	matProjective Matrix_Projection(float fFovDegrees, float fAspectRatio, float fNear, float fFar)
 	{
 		float fFovRad = 1.0f / tanf(fFovDegrees * 0.5f / 180.0f * 3.14159f);
-		mat4x4 matrix;
+		matProjective matrix;
 		matrix.m[0][0] = fAspectRatio * fFovRad;
 		matrix.m[1][1] = fFovRad;
 		matrix.m[2][2] = fFar / (fFar - fNear);
@@ -90,16 +122,50 @@ protected:
 		return matrix;
 	}
 
-	mat4x4 Matrix_MultiplyMatrix(mat4x4& m1, mat4x4& m2)
+	// Takes clip space to the screen: after dividing by w, x and y run from
+	// fOffset - fScale to fOffset + fScale instead of -1 to +1. The offset is
+	// scaled by w here so that the divide leaves it unscaled, which lets the
+	// viewport go on the end of the projection matrix
+	matAffine Matrix_Viewport(float fScaleX, float fOffsetX, float fScaleY, float fOffsetY)
+	{
+		matAffine matrix;
+		matrix.m[0][0] = fScaleX;
+		matrix.m[1][1] = fScaleY;
+		matrix.m[2][2] = 1.0f;
+		matrix.m[3][0] = fOffsetX;
+		matrix.m[3][1] = fOffsetY;
+		matrix.m[3][3] = 1.0f;
+		return matrix;
+	}
+
+	mat4x4 Matrix_MultiplyMatrix(const mat4x4& m1, const mat4x4& m2)
 	{
 		mat4x4 matrix;
+#if HAMRO_SIMD
+		// Row r of the result is row r of m1 multiplied into m2, like a vector
+		for (int r = 0; r < 4; r++)
+			_mm_store_ps(matrix.m[r], simd::MultiplyRows(simd::LoadRow(m1, r), m2));
+#else
 		for (int c = 0; c < 4; c++)
 			for (int r = 0; r < 4; r++)
 				matrix.m[r][c] = m1.m[r][0] * m2.m[0][c] + m1.m[r][1] * m2.m[1][c] + m1.m[r][2] * m2.m[2][c] + m1.m[r][3] * m2.m[3][c];
+#endif
 		return matrix;
 	}
 
-	mat4x4 Matrix_PointAt(vec3d& pos, vec3d& target, vec3d& up)
+	// Composition keeps the more general of the two kinds. Unless one of them is
+	// projective, both have 0, 0, 0, 1 as their last column and so does the
+	// result, so only the other three columns are worked out
+	template<matrixKind A, matrixKind B>
+	transform<(A > B ? A : B)> Matrix_MultiplyMatrix(const transform<A>& m1, const transform<B>& m2)
+	{
+		typedef transform<(A > B ? A : B)> result;
+		if (A == matrixKind::Projective || B == matrixKind::Projective)
+			return result(Matrix_MultiplyMatrix((const mat4x4&)m1, (const mat4x4&)m2));
+		return result(Matrix_MultiplyAffine(m1, m2));
+	}
+
+	matRigid Matrix_PointAt(const vec3d& pos, const vec3d& target, const vec3d& up)
 	{
 		// Calculate new forward direction
 		vec3d newForward = Vector_Sub(target, pos);
@@ -114,7 +180,7 @@ protected:
 		vec3d newRight = Vector_CrossProduct(newUp, newForward);
 
 		// Construct Dimensioning and Translation Matrix	
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = newRight.x;	matrix.m[0][1] = newRight.y;	matrix.m[0][2] = newRight.z;	matrix.m[0][3] = 0.0f;
 		matrix.m[1][0] = newUp.x;		matrix.m[1][1] = newUp.y;		matrix.m[1][2] = newUp.z;		matrix.m[1][3] = 0.0f;
 		matrix.m[2][0] = newForward.x;	matrix.m[2][1] = newForward.y;	matrix.m[2][2] = newForward.z;	matrix.m[2][3] = 0.0f;
@@ -123,9 +189,11 @@ protected:
 
 	}
 
-	mat4x4 Matrix_Inverse(mat4x4& m) // Only for Rotation/Translation Matrices
+	// A rigid matrix is inverted by transposing its rotation and rotating its
+	// translation back
+	matRigid Matrix_Inverse(const matRigid& m)
 	{
-		mat4x4 matrix;
+		matRigid matrix;
 		matrix.m[0][0] = m.m[0][0]; matrix.m[0][1] = m.m[1][0]; matrix.m[0][2] = m.m[2][0]; matrix.m[0][3] = 0.0f;
 		matrix.m[1][0] = m.m[0][1]; matrix.m[1][1] = m.m[1][1]; matrix.m[1][2] = m.m[2][1]; matrix.m[1][3] = 0.0f;
 		matrix.m[2][0] = m.m[0][2]; matrix.m[2][1] = m.m[1][2]; matrix.m[2][2] = m.m[2][2]; matrix.m[2][3] = 0.0f;
@@ -136,6 +204,102 @@ protected:
 		return matrix;
 	}
 
+	// The upper 3x3 part is inverted by cofactors over the determinant and the
+	// translation is taken back through it. m must not be singular
+	matAffine Matrix_Inverse(const matAffine& m)
+	{
+		// Transposed cofactors, the first column of them also gives the determinant
+		matAffine matrix;
+		matrix.m[0][0] = m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1];
+		matrix.m[1][0] = m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2];
+		matrix.m[2][0] = m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0];
+		matrix.m[0][1] = m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2];
+		matrix.m[1][1] = m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0];
+		matrix.m[2][1] = m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1];
+		matrix.m[0][2] = m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1];
+		matrix.m[1][2] = m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2];
+		matrix.m[2][2] = m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0];
+		float fInvDet = 1.0f / (m.m[0][0] * matrix.m[0][0] + m.m[0][1] * matrix.m[1][0] + m.m[0][2] * matrix.m[2][0]);
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				matrix.m[r][c] *= fInvDet;
+		for (int c = 0; c < 3; c++)
+			matrix.m[3][c] = -(m.m[3][0] * matrix.m[0][c] + m.m[3][1] * matrix.m[1][c] + m.m[3][2] * matrix.m[2][c]);
+		matrix.m[3][3] = 1.0f;
+		return matrix;
+	}
+
+	// General inverse by cofactors, built from the 2x2 determinants of the top
+	// two rows (s) and the bottom two rows (c). m must not be singular
+	matProjective Matrix_Inverse(const matProjective& m)
+	{
+		auto& a = m.m;
+		float s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+		float s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+		float s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+		float s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+		float s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+		float s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+		float c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+		float c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+		float c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+		float c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+		float c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+		float c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+		float fInvDet = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+		matProjective matrix;
+		auto& b = matrix.m;
+		b[0][0] = (a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * fInvDet;
+		b[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * fInvDet;
+		b[0][2] = (a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * fInvDet;
+		b[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * fInvDet;
+		b[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * fInvDet;
+		b[1][1] = (a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * fInvDet;
+		b[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * fInvDet;
+		b[1][3] = (a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * fInvDet;
+		b[2][0] = (a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * fInvDet;
+		b[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * fInvDet;
+		b[2][2] = (a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * fInvDet;
+		b[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * fInvDet;
+		b[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * fInvDet;
+		b[3][1] = (a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * fInvDet;
+		b[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * fInvDet;
+		b[3][3] = (a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * fInvDet;
+		return matrix;
+	}
+
+	// Determinant of the upper 3x3 (rotation/scale) part, negative if the matrix mirrors
+	float Matrix_Determinant3x3(const mat4x4& m)
+	{
+		return m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1])
+			- m.m[0][1] * (m.m[1][0] * m.m[2][2] - m.m[1][2] * m.m[2][0])
+			+ m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+	}
+
+	// Matrix for face normals of a model drawn with m: the inverse transpose of
+	// its upper 3x3 part (cofactors over the determinant), which keeps normals at
+	// right angles to their faces when m doesn't. Dividing by the size of the
+	// determinant rather than the determinant itself also turns a normal around
+	// when m mirrors, so it stays on the side that is now the front face. Only
+	// rotations and mirroring keep normals unit length
+	matAffine Matrix_NormalMatrix(const mat4x4& m)
+	{
+		float fInvDet = 1.0f / fabsf(Matrix_Determinant3x3(m));
+		matAffine matrix;
+		matrix.m[0][0] = (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1]) * fInvDet;
+		matrix.m[0][1] = (m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2]) * fInvDet;
+		matrix.m[0][2] = (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]) * fInvDet;
+		matrix.m[1][0] = (m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2]) * fInvDet;
+		matrix.m[1][1] = (m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0]) * fInvDet;
+		matrix.m[1][2] = (m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1]) * fInvDet;
+		matrix.m[2][0] = (m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1]) * fInvDet;
+		matrix.m[2][1] = (m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2]) * fInvDet;
+		matrix.m[2][2] = (m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0]) * fInvDet;
+		matrix.m[3][3] = 1.0f;
+		return matrix;
+	}
+
 	float ambient(vec3d light_dir, vec3d normal) {
 		return MAX(0.1f, Vector_DotProduct(light_dir, normal));
 	}
@@ -143,4 +307,26 @@ protected:
 	float specular(vec3d light_dir, vec3d normal, vec3d camera_ray) {
 		return MAX(0.00001f, abs(Vector_DotProduct(light_dir, normal) - Vector_Length(camera_ray)));
 	}
+
+private:
+	// Product of two matrices whose last column is 0, 0, 0, 1, which the result
+	// has too: the w terms of rows 0 - 2 are zero and the w term of row 3 is
+	// just row 3 of m2. Working a row at a time keeps it to 4 wide operations
+	// with SSE, and lets compilers do the same with the plain C++ loops
+	mat4x4 Matrix_MultiplyAffine(const mat4x4& m1, const mat4x4& m2)
+	{
+		mat4x4 matrix;
+#if HAMRO_SIMD
+		for (int r = 0; r < 3; r++)
+			_mm_store_ps(matrix.m[r], simd::MultiplyRows3(simd::LoadRow(m1, r), m2));
+		_mm_store_ps(matrix.m[3], _mm_add_ps(simd::MultiplyRows3(simd::LoadRow(m1, 3), m2), simd::LoadRow(m2, 3)));
+#else
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 4; c++)
+				matrix.m[r][c] = m1.m[r][0] * m2.m[0][c] + m1.m[r][1] * m2.m[1][c] + m1.m[r][2] * m2.m[2][c];
+		for (int c = 0; c < 4; c++)
+			matrix.m[3][c] = m1.m[3][0] * m2.m[0][c] + m1.m[3][1] * m2.m[1][c] + m1.m[3][2] * m2.m[2][c] + m2.m[3][c];
+#endif
+		return matrix;
+	}
 };
\ No newline at end of file
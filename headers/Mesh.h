@@ -1,10 +1,21 @@
 #pragma once
 
+#include<vector>
+#include<string>
 #include<fstream>
-#include<strstream>
+#include<cstdio>
+#include<cstring>
+#include<cstdint>
+#include<algorithm>
+#include<cmath>
 
-// Represent coordinates in 3D space
-struct vec3d
+#include "MappedFile.h"
+#include "ObjParser.h"
+#include "ThreadPool.h"
+#include "MeshOptimize.h"
+
+// Represent coordinates in 3D space, aligned so SSE can load it whole
+struct alignas(16) vec3d
 {
 	float x = 0;
 	float y = 0;
@@ -17,55 +28,505 @@ struct triangle
 {
 	vec3d p[3];
 
-	wchar_t sym; // symbol that represents color of the triangles
-	short col;
+	uint8_t shade;	// How the triangle is drawn, an index into hamroGraphics' palette
 };
 
-// 4x4 matrix
-struct mat4x4 {
+// 4x4 matrix, each row aligned like a vec3d
+struct alignas(16) mat4x4 {
 	float m[4][4] = { 0 };
 };
 
+// Vertices and triangle corners parsed from one line aligned chunk of an OBJ file
+struct objChunk
+{
+	std::vector<vec3d> verts;
+	// Three zero based vertex indices per triangle. Positive OBJ indices are
+	// already absolute, negative ones can only be resolved once we know how many
+	// vertices came before this chunk, so they are stored relative to the chunk's
+	// first vertex and their positions are listed in relative
+	std::vector<int64_t> corners;
+	std::vector<uint32_t> relative;
+	bool bValid = true;
+};
+
+// Chunks smaller than this aren't worth handing to another thread
+const size_t OBJ_MIN_CHUNK_SIZE = 256 * 1024;
+
+// Parse the v and f records in [p, end), which must start at the beginning of a line
+inline void ParseObjChunk(const char* p, const char* end, objChunk& chunk)
+{
+	// Corners of the face currently being read, reused for every face
+	struct sCorner { int64_t index; bool bRelative; };
+	std::vector<sCorner> face;
+
+	while (p < end)
+	{
+		// Each line starts with a keyword that describes what the line is eg: v, f
+		p = obj::SkipSpace(p, end);
+
+		if (end - p > 1 && p[0] == 'v' && obj::IsSpace(p[1]))
+		{
+			vec3d vertex;
+			p = obj::ParseFloat(obj::SkipSpace(p + 1, end), end, vertex.x);
+			p = obj::ParseFloat(obj::SkipSpace(p, end), end, vertex.y);
+			p = obj::ParseFloat(obj::SkipSpace(p, end), end, vertex.z);
+			chunk.verts.push_back(vertex);
+		}
+		else if (end - p > 1 && p[0] == 'f' && obj::IsSpace(p[1]))
+		{
+			// Each corner is "v", "v/vt", "v//vn" or "v/vt/vn", we only need v.
+			// A # ends the corners, the rest of the line is a comment
+			face.clear();
+			p = obj::SkipSpace(p + 1, end);
+			while (p < end && *p != '\n' && *p != '#')
+			{
+				int index;
+				const char* q = obj::ParseInt(p, end, index);
+				if (q == p || index == 0)
+				{
+					chunk.bValid = false;
+					return;
+				}
+
+				// Negative indices are relative to the vertices read so far
+				if (index < 0)
+					face.push_back({ (int64_t)chunk.verts.size() + index, true });
+				else
+					face.push_back({ (int64_t)index - 1, false });
+
+				while (q < end && !obj::IsSpace(*q) && *q != '\n' && *q != '#') q++;
+				p = obj::SkipSpace(q, end);
+			}
+
+			// Quads and n-gons are split into a fan of triangles around the first corner
+			for (size_t i = 2; i < face.size(); i++)
+			{
+				const sCorner* corners[3] = { &face[0], &face[i - 1], &face[i] };
+				for (const sCorner* c : corners)
+				{
+					if (c->bRelative)
+						chunk.relative.push_back((uint32_t)chunk.corners.size());
+					chunk.corners.push_back(c->index);
+				}
+			}
+		}
+
+		p = obj::SkipLine(p, end);
+	}
+}
+
+// Header of a baked mesh cache file (.mesh). The header is followed by the x, y
+// and z position streams (nVerts floats each, padded to Mesh_StreamLength), nTris
+// face planes and then nTris index triples, laid out so that a memory mapping of
+// the file can be used in place. Data is in native (little endian) order
+struct meshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t nVerts;
+	uint32_t nTris;
+	uint64_t sourceSize;	// Size and modification time of the OBJ file the cache was baked from
+	uint64_t sourceTime;
+	vec3d vMin, vMax;		// Bounding box of the vertices
+};
+
+static_assert(sizeof(vec3d) == 16, "mesh cache stores vec3d as 4 floats");
+static_assert(sizeof(meshCacheHeader) == 64, "mesh cache header must keep vertices 16 byte aligned");
+
+const char MESH_CACHE_MAGIC[4] = { 'H', 'M', 'S', 'H' };
+const uint32_t MESH_CACHE_VERSION = 4;
+
+// Floats stored for each position stream of nVerts vertices, rounded up to a
+// multiple of 4 so every stream starts 16 byte aligned
+inline uint32_t Mesh_StreamLength(uint32_t nVerts)
+{
+	return (nVerts + 3) & ~3u;
+}
+
+// Mesh arrays compiled into the program as constexpr data by tools/obj2header,
+// with everything mesh would otherwise work out at load time
+struct embeddedMesh
+{
+	const float* pX;
+	const float* pY;
+	const float* pZ;
+	const vec3d* pPlanes;
+	const uint32_t* pIndices;
+	uint32_t nVerts;
+	uint32_t nTris;
+	vec3d vMin, vMax;
+	vec3d vCentre;
+	float fRadius;
+};
+
 // Group together triangles to represent object
+// Triangles are stored as index triples into a shared vertex array
 struct mesh
 {
-	std::vector<triangle> tris;
+	// These point either into our own vectors (OBJ file), straight into a
+	// memory-mapped cache file or at arrays compiled into the program, so the
+	// render loop never cares which.
+	// Positions are kept as one array per component, so a whole mesh can be
+	// transformed several vertices at a time (see Transform.h)
+	const float* pX = nullptr;
+	const float* pY = nullptr;
+	const float* pZ = nullptr;
+	const uint32_t* pIndices = nullptr;
+	// Face plane per triangle: unit normal in x, y, z and plane constant in w,
+	// so that dot(normal, p) + w is the signed distance of p from the face
+	const vec3d* pPlanes = nullptr;
+	uint32_t nVerts = 0;
+	uint32_t nTris = 0;
+	vec3d vMin, vMax;	// Axis aligned bounding box
+	vec3d vCentre;		// Bounding sphere around the centre of the box
+	float fRadius = 0.0f;
+
+	mesh() {}
+	mesh(const mesh&) = delete;
+	mesh& operator=(const mesh&) = delete;
+	mesh(mesh&&) = default;
+	mesh& operator=(mesh&&) = default;
 
-	bool LoadFromObjectFile(std::string filename)
+	// Position of vertex i
+	vec3d Vertex(uint32_t i) const
 	{
-		std::ifstream file(filename);
-		if (!file.is_open())
+		return { pX[i], pY[i], pZ[i] };
+	}
+
+	// Bytes used by the arrays: the position streams, a plane and three indices a triangle
+	size_t Bytes() const
+	{
+		return 3 * (size_t)Mesh_StreamLength(nVerts) * sizeof(float) + (size_t)nTris * (sizeof(vec3d) + 3 * sizeof(uint32_t));
+	}
+
+	// Assemble triangle i from its three vertices
+	triangle GetTriangle(uint32_t i) const
+	{
+		triangle tri;
+		tri.p[0] = Vertex(pIndices[3 * i + 0]);
+		tri.p[1] = Vertex(pIndices[3 * i + 1]);
+		tri.p[2] = Vertex(pIndices[3 * i + 2]);
+		return tri;
+	}
+
+	// Load from the baked cache next to the OBJ file if it is up to date,
+	// otherwise parse the OBJ file and (re)write the cache for next time
+	bool Load(const std::string& filename, ThreadPool* pool = nullptr)
+	{
+		uint64_t sourceSize, sourceTime;
+		if (!GetFileStamp(filename, sourceSize, sourceTime))
 			return false;
 
-		// Local cache of vertices
-		std::vector<vec3d> vertices;
+		std::string cacheFile = CacheFileName(filename);
+		if (LoadFromCacheFile(cacheFile, sourceSize, sourceTime))
+			return true;
+
+		if (!LoadFromObjectFile(filename, pool))
+			return false;
 
-		while (!file.eof())
+		// Failing to write the cache isn't fatal, we'll just parse again next time
+		SaveToCacheFile(cacheFile, sourceSize, sourceTime);
+		return true;
+	}
+
+	// <name>.obj -> <name><suffix>.mesh
+	static std::string CacheFileName(const std::string& filename, const std::string& suffix = "")
+	{
+		size_t dot = filename.find_last_of('.');
+		size_t slash = filename.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return filename + suffix + ".mesh";
+		return filename.substr(0, dot) + suffix + ".mesh";
+	}
+
+	// Parse an OBJ file. With a thread pool, large files are split at line
+	// boundaries and the chunks are parsed in parallel, then merged in file
+	// order so the result is identical to parsing the file in one piece.
+	// pFileOrderACMR, if given, receives the cache miss ratio of the triangles
+	// in the order the file has them, before they are reordered
+	bool LoadFromObjectFile(std::string filename, ThreadPool* pool = nullptr, float* pFileOrderACMR = nullptr)
+	{
+		MappedFile file;
+		if (!file.Open(filename))
+			return false;
+
+		const char* data = file.Data();
+		const char* end = data + file.Size();
+
+		size_t nChunks = 1;
+		if (pool)
 		{
-			// Assuming any line of the file doesn't exceed 128 characters
-			char line[128];
-			file.getline(line, 128);
+			nChunks = file.Size() / OBJ_MIN_CHUNK_SIZE;
+			if (nChunks > pool->Size() * 4) nChunks = pool->Size() * 4;
+			if (nChunks < 1) nChunks = 1;
+		}
 
-			std::strstream stream;
-			stream << line;
+		// Chunk k covers [bounds[k], bounds[k + 1]), each boundary is moved
+		// forward to the start of a line
+		std::vector<const char*> bounds(nChunks + 1);
+		bounds[0] = data;
+		bounds[nChunks] = end;
+		for (size_t k = 1; k < nChunks; k++)
+		{
+			const char* p = obj::SkipLine(data + file.Size() * k / nChunks, end);
+			bounds[k] = p > bounds[k - 1] ? p : bounds[k - 1];
+		}
 
-			// Each line starts with a character that describes what the line is eg: v, f
-			char startingJunkChar;
+		std::vector<objChunk> chunks(nChunks);
+		auto parse = [&](size_t k) { ParseObjChunk(bounds[k], bounds[k + 1], chunks[k]); };
+		if (pool)
+			pool->ParallelFor(nChunks, parse);
+		else
+			parse(0);
 
-			if (line[0] == 'v')
+		// Merge pass: every chunk's vertices and corners go after those of the
+		// chunks before it, and its relative indices are offset by that many vertices
+		std::vector<size_t> vertexBase(nChunks + 1, 0), cornerBase(nChunks + 1, 0);
+		for (size_t k = 0; k < nChunks; k++)
+		{
+			if (!chunks[k].bValid)
+				return false;
+			vertexBase[k + 1] = vertexBase[k] + chunks[k].verts.size();
+			cornerBase[k + 1] = cornerBase[k] + chunks[k].corners.size();
+		}
+
+		std::vector<vec3d> vertices(vertexBase[nChunks]);
+		std::vector<uint32_t> faces(cornerBase[nChunks]);
+		int64_t nTotalVerts = (int64_t)vertices.size();
+
+		auto merge = [&](size_t k)
+		{
+			objChunk& chunk = chunks[k];
+			std::copy(chunk.verts.begin(), chunk.verts.end(), vertices.begin() + vertexBase[k]);
+
+			for (uint32_t i : chunk.relative)
+				chunk.corners[i] += (int64_t)vertexBase[k];
+
+			uint32_t* out = faces.data() + cornerBase[k];
+			for (size_t i = 0; i < chunk.corners.size(); i++)
+			{
+				int64_t index = chunk.corners[i];
+				if (index < 0 || index >= nTotalVerts)
+				{
+					chunk.bValid = false;
+					return;
+				}
+				out[i] = (uint32_t)index;
+			}
+		};
+		if (pool)
+			pool->ParallelFor(nChunks, merge);
+		else
+			merge(0);
+
+		for (size_t k = 0; k < nChunks; k++)
+			if (!chunks[k].bValid)
+				return false;
+
+		// Bake in a cache friendly order, triangles first since the vertex order
+		// follows from theirs
+		if (pFileOrderACMR)
+			*pFileOrderACMR = Mesh_CacheMissRatio(faces);
+		Mesh_OptimizeVertexCache(faces, (uint32_t)vertices.size());
+		Mesh_OptimizeVertexFetch(vertices, faces);
+
+		SetData(vertices, std::move(faces));
+		return true;
+	}
+
+	// Map a baked cache file and use its arrays in place. Fails if the file is
+	// missing, malformed or was baked from a different version of the source
+	bool LoadFromCacheFile(const std::string& filename, uint64_t sourceSize, uint64_t sourceTime)
+	{
+		MappedFile file;
+		if (!file.Open(filename) || file.Size() < sizeof(meshCacheHeader))
+			return false;
+
+		const meshCacheHeader* header = (const meshCacheHeader*)file.Data();
+		if (memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION)
+			return false;
+		if (header->sourceSize != sourceSize || header->sourceTime != sourceTime)
+			return false;
+
+		uint32_t nStream = Mesh_StreamLength(header->nVerts);
+		uint64_t expected = sizeof(meshCacheHeader) + 3ull * nStream * sizeof(float) + (uint64_t)header->nTris * sizeof(vec3d) + (uint64_t)header->nTris * 3 * sizeof(uint32_t);
+		if (file.Size() != expected)
+			return false;
+
+		const float* streams = (const float*)(file.Data() + sizeof(meshCacheHeader));
+		const vec3d* planes = (const vec3d*)(streams + 3 * (size_t)nStream);
+		const uint32_t* indices = (const uint32_t*)(planes + header->nTris);
+		for (uint32_t i = 0; i < header->nTris * 3; i++)
+			if (indices[i] >= header->nVerts)
+				return false;
+
+		m_pos.clear();
+		m_indices.clear();
+		m_planes.clear();
+		pX = streams;
+		pY = streams + nStream;
+		pZ = streams + 2 * (size_t)nStream;
+		pIndices = indices;
+		pPlanes = planes;
+		nVerts = header->nVerts;
+		nTris = header->nTris;
+		vMin = header->vMin;
+		vMax = header->vMax;
+		m_mapping = std::move(file);
+		ComputeSphere();
+		return true;
+	}
+
+	// Use arrays compiled into the program in place, no I/O or parsing at all
+	void LoadFromEmbedded(const embeddedMesh& data)
+	{
+		m_mapping.Close();
+		m_pos.clear();
+		m_indices.clear();
+		m_planes.clear();
+		pX = data.pX;
+		pY = data.pY;
+		pZ = data.pZ;
+		pIndices = data.pIndices;
+		pPlanes = data.pPlanes;
+		nVerts = data.nVerts;
+		nTris = data.nTris;
+		vMin = data.vMin;
+		vMax = data.vMax;
+		vCentre = data.vCentre;
+		fRadius = data.fRadius;
+	}
+
+	bool SaveToCacheFile(const std::string& filename, uint64_t sourceSize, uint64_t sourceTime) const
+	{
+		meshCacheHeader header;
+		memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+		header.version = MESH_CACHE_VERSION;
+		header.nVerts = nVerts;
+		header.nTris = nTris;
+		header.sourceSize = sourceSize;
+		header.sourceTime = sourceTime;
+		header.vMin = vMin;
+		header.vMax = vMax;
+
+		// Write to a temporary file and rename it over the cache, so that another
+		// process never maps a half written file
+		std::string tmpFile = filename + ".tmp";
+		{
+			std::ofstream file(tmpFile, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+			file.write((const char*)&header, sizeof(header));
+			// Each stream is padded with zeros up to its stored length
+			std::vector<float> padding(Mesh_StreamLength(nVerts) - nVerts, 0.0f);
+			for (const float* stream : { pX, pY, pZ })
+			{
+				file.write((const char*)stream, (std::streamsize)nVerts * sizeof(float));
+				file.write((const char*)padding.data(), (std::streamsize)padding.size() * sizeof(float));
+			}
+			file.write((const char*)pPlanes, (std::streamsize)nTris * sizeof(vec3d));
+			file.write((const char*)pIndices, (std::streamsize)nTris * 3 * sizeof(uint32_t));
+			if (!file.good())
 			{
-				vec3d vertex;
-				stream >> startingJunkChar >> vertex.x >> vertex.y >> vertex.z;
-				vertices.push_back(vertex);
+				file.close();
+				std::remove(tmpFile.c_str());
+				return false;
 			}
+		}
 
-			if (line[0] == 'f')
+		if (std::rename(tmpFile.c_str(), filename.c_str()) != 0)
+		{
+			// Windows won't rename over an existing file
+			std::remove(filename.c_str());
+			if (std::rename(tmpFile.c_str(), filename.c_str()) != 0)
 			{
-				int f[3]; // face
-				stream >> startingJunkChar >> f[0] >> f[1] >> f[2];
-				tris.push_back({ vertices[f[0] - 1], vertices[f[1] - 1], vertices[f[2] - 1] });
+				std::remove(tmpFile.c_str());
+				return false;
 			}
 		}
 		return true;
 	}
+
+	// Take ownership of index arrays built in memory (eg: by the OBJ parser or
+	// the mesh simplifier), split the positions into streams and compute their
+	// bounds and face planes
+	void SetData(const std::vector<vec3d>& verts, std::vector<uint32_t>&& indices)
+	{
+		m_mapping.Close();
+		m_indices = std::move(indices);
+		nVerts = (uint32_t)verts.size();
+		nTris = (uint32_t)(m_indices.size() / 3);
+
+		uint32_t nStream = Mesh_StreamLength(nVerts);
+		m_pos.assign(3 * (size_t)nStream, 0.0f);
+		for (uint32_t i = 0; i < nVerts; i++)
+		{
+			m_pos[i] = verts[i].x;
+			m_pos[nStream + i] = verts[i].y;
+			m_pos[2 * (size_t)nStream + i] = verts[i].z;
+		}
+		pX = m_pos.data();
+		pY = pX + nStream;
+		pZ = pY + nStream;
+		pIndices = m_indices.data();
+
+		vMin = vMax = vec3d();
+		for (uint32_t i = 0; i < nVerts; i++)
+		{
+			const vec3d& v = verts[i];
+			if (i == 0 || v.x < vMin.x) vMin.x = v.x;
+			if (i == 0 || v.y < vMin.y) vMin.y = v.y;
+			if (i == 0 || v.z < vMin.z) vMin.z = v.z;
+			if (i == 0 || v.x > vMax.x) vMax.x = v.x;
+			if (i == 0 || v.y > vMax.y) vMax.y = v.y;
+			if (i == 0 || v.z > vMax.z) vMax.z = v.z;
+		}
+		ComputeSphere();
+
+		m_planes.resize(nTris);
+		for (uint32_t i = 0; i < nTris; i++)
+		{
+			const vec3d& p0 = verts[pIndices[3 * i + 0]];
+			const vec3d& p1 = verts[pIndices[3 * i + 1]];
+			const vec3d& p2 = verts[pIndices[3 * i + 2]];
+
+			// Normal to triangle surface = Cross product of two lines either side of it
+			float ux = p1.x - p0.x, uy = p1.y - p0.y, uz = p1.z - p0.z;
+			float vx = p2.x - p0.x, vy = p2.y - p0.y, vz = p2.z - p0.z;
+			vec3d n = { uy * vz - uz * vy, uz * vx - ux * vz, ux * vy - uy * vx };
+			float l = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+
+			// Degenerate triangles get an all zero plane, which is never front facing
+			if (l > 0.0f)
+			{
+				n.x /= l; n.y /= l; n.z /= l;
+				n.w = -(n.x * p0.x + n.y * p0.y + n.z * p0.z);
+			}
+			else
+				n = { 0.0f, 0.0f, 0.0f, 0.0f };
+			m_planes[i] = n;
+		}
+		pPlanes = m_planes.data();
+	}
+
+private:
+	// Storage behind pX/pY/pZ (one stream after another), pIndices and pPlanes,
+	// used instead of m_mapping
+	std::vector<float> m_pos;
+	std::vector<uint32_t> m_indices;
+	std::vector<vec3d> m_planes;
+	MappedFile m_mapping;
+
+	void ComputeSphere()
+	{
+		vCentre = { (vMin.x + vMax.x) * 0.5f, (vMin.y + vMax.y) * 0.5f, (vMin.z + vMax.z) * 0.5f };
+		float fRadiusSq = 0.0f;
+		for (uint32_t i = 0; i < nVerts; i++)
+		{
+			float dx = pX[i] - vCentre.x, dy = pY[i] - vCentre.y, dz = pZ[i] - vCentre.z;
+			float d = dx * dx + dy * dy + dz * dz;
+			if (d > fRadiusSq) fRadiusSq = d;
+		}
+		fRadius = sqrtf(fRadiusSq);
+	}
 };
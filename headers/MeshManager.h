@@ -0,0 +1,155 @@
+#pragma once
+
+#include "MeshSimplify.h"
+#include "MeshPacked.h"
+#include "Occlusion.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// A mesh, and optionally its levels of detail, loaded on a worker thread. The
+// loader fills in a mesh before setting its ready flag, so once the flag is set
+// the game thread may read it without locking
+struct meshAsset
+{
+	mesh full;
+	std::vector<mesh> lods;
+	meshPacked packed;	// Only for assets requested packed, full is left empty then
+	std::vector<meshCluster> clusters;	// Bounds of the triangles of full or packed, CLUSTER_TRIS at a time
+	std::atomic<bool> bLoaded{ false };
+	std::atomic<bool> bLODsLoaded{ false };
+	std::atomic<bool> bFailed{ false };
+};
+
+// A model and its levels of detail as compiled in by tools/obj2header
+struct embeddedModel
+{
+	embeddedMesh full;
+	const embeddedMesh* pLODs;
+	uint32_t nLODs;
+};
+
+// Shared reference to an asset owned by a MeshManager, cheap to copy
+class meshHandle
+{
+public:
+	meshHandle() {}
+	explicit meshHandle(std::shared_ptr<meshAsset> asset) : m_asset(std::move(asset)) {}
+
+	bool Valid() const { return m_asset != nullptr; }
+	bool Ready() const { return m_asset && m_asset->bLoaded; }
+	bool Failed() const { return m_asset && m_asset->bFailed; }
+
+	// The mesh, or null while it is still loading
+	const mesh* Get() const { return Ready() ? &m_asset->full : nullptr; }
+
+	// The packed copy, or null while loading or if the asset wasn't requested packed
+	const meshPacked* Packed() const { return Ready() && m_asset->packed.nTris ? &m_asset->packed : nullptr; }
+
+	// Bounding boxes of the mesh's (or the packed copy's) clusters of triangles,
+	// empty while it is still loading
+	const std::vector<meshCluster>& Clusters() const
+	{
+		static const std::vector<meshCluster> none;
+		return Ready() ? m_asset->clusters : none;
+	}
+
+	// Levels of detail, empty until they are ready (they finish after the mesh)
+	const std::vector<mesh>& LODs() const
+	{
+		static const std::vector<mesh> none;
+		return m_asset && m_asset->bLODsLoaded ? m_asset->lods : none;
+	}
+
+private:
+	std::shared_ptr<meshAsset> m_asset;
+};
+
+// Loads meshes on a thread pool and hands out handles to them. Each file is
+// loaded once however many times it is requested
+class MeshManager
+{
+public:
+	explicit MeshManager(ThreadPool& pool) : m_pool(pool) {}
+
+	MeshManager(const MeshManager&) = delete;
+	MeshManager& operator=(const MeshManager&) = delete;
+
+	// Loads still running write into their assets, let them finish first
+	~MeshManager() { Wait(); }
+
+	// Handle to filename, queuing it for loading the first time it is asked for.
+	// bLODs and bPacked are taken from that first request. A packed asset keeps
+	// only its packed copy, without levels of detail
+	meshHandle Request(const std::string& filename, bool bLODs = false, bool bPacked = false)
+	{
+		std::unique_lock<std::mutex> lock(m_mux);
+		auto it = m_assets.find(filename);
+		if (it != m_assets.end())
+			return meshHandle(it->second);
+
+		auto asset = std::make_shared<meshAsset>();
+		m_assets[filename] = asset;
+
+		ThreadPool* pool = &m_pool;
+		m_pending.push_back(m_pool.Submit([asset, filename, bLODs, bPacked, pool]()
+			{
+				if (!asset->full.Load(filename, pool))
+				{
+					asset->bFailed = true;
+					return;
+				}
+				if (bPacked)
+				{
+					Mesh_Pack(asset->full, asset->packed);
+					Mesh_BuildClusters(asset->packed, asset->clusters);
+					asset->full = mesh();
+					asset->bLoaded = true;
+					return;
+				}
+				Mesh_BuildClusters(asset->full, asset->clusters);
+				asset->bLoaded = true;
+
+				if (bLODs && Mesh_LoadLODs(filename, asset->full, asset->lods))
+					asset->bLODsLoaded = true;
+			}));
+		return meshHandle(asset);
+	}
+
+	// Register a model compiled into the program under filename, so requests
+	// for it are ready straight away instead of going to disk
+	void AddEmbedded(const std::string& filename, const embeddedModel& model)
+	{
+		auto asset = std::make_shared<meshAsset>();
+		asset->full.LoadFromEmbedded(model.full);
+		Mesh_BuildClusters(asset->full, asset->clusters);
+		asset->lods.resize(model.nLODs);
+		for (uint32_t i = 0; i < model.nLODs; i++)
+			asset->lods[i].LoadFromEmbedded(model.pLODs[i]);
+		asset->bLoaded = true;
+		asset->bLODsLoaded = true;
+
+		std::unique_lock<std::mutex> lock(m_mux);
+		m_assets[filename] = asset;
+	}
+
+	// Block until everything requested so far has finished loading
+	void Wait()
+	{
+		std::vector<std::future<void>> pending;
+		{
+			std::unique_lock<std::mutex> lock(m_mux);
+			pending.swap(m_pending);
+		}
+		for (auto& f : pending)
+			f.wait();
+	}
+
+private:
+	ThreadPool& m_pool;
+	std::map<std::string, std::shared_ptr<meshAsset>> m_assets;
+	std::vector<std::future<void>> m_pending;
+	std::mutex m_mux;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+// Reordering passes run on a mesh when it is loaded or baked. They don't change
+// what is drawn, only the order triangles and vertices sit in memory
+
+// Size of the vertex cache simulated by Tom Forsyth's "Linear-Speed Vertex Cache
+// Optimisation" and of the LRU cache the miss ratio is measured with
+const int VERTEX_CACHE_SIZE = 32;
+
+// Reorder triangles so that consecutive triangles share as many recently used
+// vertices as possible (Forsyth). Each step emits the remaining triangle whose
+// vertices score highest: recently used vertices score high, and so do vertices
+// with few triangles left, so that nothing is left stranded
+inline void Mesh_OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t nVerts)
+{
+	const float fCacheDecayPower = 1.5f;
+	const float fLastTriScore = 0.75f;
+	const float fValenceBoostScale = 2.0f;
+	const float fValenceBoostPower = 0.5f;
+
+	uint32_t nTris = (uint32_t)(indices.size() / 3);
+	if (nTris == 0)
+		return;
+
+	auto vertexScore = [&](int cachePos, uint32_t nRemaining)
+	{
+		if (nRemaining == 0)
+			return -1.0f;	// No triangles left, never pick this vertex again
+
+		float fScore = 0.0f;
+		if (cachePos >= 0)
+		{
+			if (cachePos < 3)
+				fScore = fLastTriScore;	// Used by the last triangle, don't favour it too much
+			else
+				fScore = powf(1.0f - (float)(cachePos - 3) / (VERTEX_CACHE_SIZE - 3), fCacheDecayPower);
+		}
+		return fScore + fValenceBoostScale * powf((float)nRemaining, -fValenceBoostPower);
+	};
+
+	// Triangles around each vertex, as ranges in one array
+	std::vector<uint32_t> nRemaining(nVerts, 0);
+	for (uint32_t i : indices)
+		nRemaining[i]++;
+	std::vector<uint32_t> adjStart(nVerts + 1, 0);
+	for (uint32_t v = 0; v < nVerts; v++)
+		adjStart[v + 1] = adjStart[v] + nRemaining[v];
+	std::vector<uint32_t> adj(indices.size());
+	{
+		std::vector<uint32_t> fill(adjStart.begin(), adjStart.end() - 1);
+		for (uint32_t t = 0; t < nTris; t++)
+			for (int k = 0; k < 3; k++)
+				adj[fill[indices[3 * t + k]]++] = t;
+	}
+
+	std::vector<int> cachePos(nVerts, -1);
+	std::vector<float> vertScore(nVerts);
+	for (uint32_t v = 0; v < nVerts; v++)
+		vertScore[v] = vertexScore(-1, nRemaining[v]);
+
+	std::vector<float> triScore(nTris);
+	std::vector<bool> triAdded(nTris, false);
+	for (uint32_t t = 0; t < nTris; t++)
+		triScore[t] = vertScore[indices[3 * t]] + vertScore[indices[3 * t + 1]] + vertScore[indices[3 * t + 2]];
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	// LRU cache, with room for the 3 vertices pushed in before the oldest fall out
+	std::vector<uint32_t> cache, newCache;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+	newCache.reserve(VERTEX_CACHE_SIZE + 3);
+
+	int64_t bestTri = 0;
+	for (uint32_t t = 1; t < nTris; t++)
+		if (triScore[t] > triScore[bestTri]) bestTri = t;
+	uint32_t nextUnadded = 0;	// Fallback scan position for when the cache runs dry
+
+	for (uint32_t nAdded = 0; nAdded < nTris; nAdded++)
+	{
+		if (bestTri < 0)
+		{
+			while (triAdded[nextUnadded]) nextUnadded++;
+			bestTri = nextUnadded;
+		}
+
+		uint32_t t = (uint32_t)bestTri;
+		const uint32_t* tv = &indices[3 * t];
+		triAdded[t] = true;
+		result.insert(result.end(), tv, tv + 3);
+
+		// Take the triangle off its vertices' lists
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = tv[k];
+			uint32_t* begin = &adj[adjStart[v]];
+			uint32_t* last = begin + nRemaining[v] - 1;
+			for (uint32_t* p = begin; p <= last; p++)
+				if (*p == t) { *p = *last; *last = t; break; }
+			nRemaining[v]--;
+		}
+
+		// Move the triangle's vertices to the front of the cache
+		newCache.assign(tv, tv + 3);
+		for (uint32_t v : cache)
+			if (v != tv[0] && v != tv[1] && v != tv[2])
+				newCache.push_back(v);
+		cache.swap(newCache);
+
+		// Rescore everything in (or just pushed out of) the cache and find the best
+		// triangle among theirs
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			uint32_t v = cache[i];
+			cachePos[v] = i < (size_t)VERTEX_CACHE_SIZE ? (int)i : -1;
+			vertScore[v] = vertexScore(cachePos[v], nRemaining[v]);
+		}
+
+		bestTri = -1;
+		float fBestScore = -1.0f;
+		for (uint32_t v : cache)
+			for (uint32_t j = 0; j < nRemaining[v]; j++)
+			{
+				uint32_t at = adj[adjStart[v] + j];
+				const uint32_t* av = &indices[3 * at];
+				triScore[at] = vertScore[av[0]] + vertScore[av[1]] + vertScore[av[2]];
+				if (triScore[at] > fBestScore)
+				{
+					fBestScore = triScore[at];
+					bestTri = at;
+				}
+			}
+
+		if (cache.size() > (size_t)VERTEX_CACHE_SIZE)
+			cache.resize(VERTEX_CACHE_SIZE);
+	}
+
+	indices.swap(result);
+}
+
+// Renumber vertices in the order the triangles first use them, so walking the
+// triangles walks the vertex array (nearly) front to back. Vertices no triangle
+// uses are dropped
+template<class V>
+void Mesh_OptimizeVertexFetch(std::vector<V>& verts, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(verts.size(), UINT32_MAX);
+	std::vector<V> newVerts;
+	newVerts.reserve(verts.size());
+
+	for (uint32_t& i : indices)
+	{
+		if (remap[i] == UINT32_MAX)
+		{
+			remap[i] = (uint32_t)newVerts.size();
+			newVerts.push_back(verts[i]);
+		}
+		i = remap[i];
+	}
+
+	verts.swap(newVerts);
+}
+
+// Average number of vertices missing from an LRU cache of VERTEX_CACHE_SIZE per
+// triangle (ACMR): 3 is no reuse at all, about 0.5 - 0.7 is the best achievable
+inline float Mesh_CacheMissRatio(const std::vector<uint32_t>& indices)
+{
+	if (indices.empty())
+		return 0.0f;
+
+	std::vector<uint32_t> cache;
+	uint32_t nMisses = 0;
+	for (uint32_t i : indices)
+	{
+		bool bHit = false;
+		for (size_t j = 0; j < cache.size(); j++)
+			if (cache[j] == i)
+			{
+				cache.erase(cache.begin() + j);
+				bHit = true;
+				break;
+			}
+		if (!bHit)
+		{
+			nMisses++;
+			if (cache.size() == (size_t)VERTEX_CACHE_SIZE)
+				cache.pop_back();
+		}
+		cache.insert(cache.begin(), i);
+	}
+	return (float)nMisses / (float)(indices.size() / 3);
+}
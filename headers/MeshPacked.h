@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Mesh.h"
+
+// Compact copy of a mesh for large models, where reading the vertex, plane and
+// index arrays costs more than the maths done with them. Positions are stored as
+// 16 bit fractions of the bounding box and indices as small deltas, and both are
+// decoded as they are read. Face planes aren't stored at all, they are worked out
+// again from the decoded positions
+
+// Quantized position: 0 .. 65535 across the bounding box on each axis
+struct packedVertex
+{
+	uint16_t x, y, z;
+};
+
+// Indices are coded in blocks of this many triangles. Each index in a block is
+// stored as its difference from the block's smallest index, in just enough bits
+// for the largest difference. Reordering at load time (MeshOptimize.h) keeps the
+// indices of nearby triangles close, so a block usually needs 8 - 10 bits an index
+const uint32_t INDEX_BLOCK_TRIS = 64;
+
+struct packedIndexBlock
+{
+	uint32_t offset;	// Byte offset of the block's bits in indexData
+	uint32_t base;		// Smallest index in the block
+	uint32_t bits;		// Bits per index
+};
+
+struct meshPacked
+{
+	std::vector<packedVertex> verts;
+	std::vector<packedIndexBlock> blocks;
+	std::vector<uint8_t> indexData;	// Padded so every index can be read with one 8 byte load
+	uint32_t nVerts = 0;
+	uint32_t nTris = 0;
+	vec3d vQuantScale, vQuantOffset;	// position = vQuantOffset + q * vQuantScale
+	vec3d vMin, vMax;	// Same bounds as the mesh it was packed from
+	vec3d vCentre;
+	float fRadius = 0.0f;
+
+	vec3d Dequantize(const packedVertex& q) const
+	{
+		return { vQuantOffset.x + q.x * vQuantScale.x, vQuantOffset.y + q.y * vQuantScale.y, vQuantOffset.z + q.z * vQuantScale.z };
+	}
+
+	// Bytes used by the arrays
+	size_t Bytes() const
+	{
+		return verts.size() * sizeof(packedVertex) + blocks.size() * sizeof(packedIndexBlock) + indexData.size();
+	}
+};
+
+// Index i of a block (0 .. 3 * INDEX_BLOCK_TRIS - 1). Bits are stored little endian
+inline uint32_t Mesh_ReadIndex(const uint8_t* indexData, const packedIndexBlock& block, uint32_t i)
+{
+	uint32_t bit = i * block.bits;
+	uint64_t v;
+	memcpy(&v, indexData + block.offset + (bit >> 3), sizeof(v));
+	return block.base + (uint32_t)((v >> (bit & 7)) & ((1ull << block.bits) - 1));
+}
+
+inline void Mesh_Pack(const mesh& src, meshPacked& out)
+{
+	out.nVerts = src.nVerts;
+	out.nTris = src.nTris;
+	out.vMin = src.vMin;
+	out.vMax = src.vMax;
+	out.vCentre = src.vCentre;
+	out.fRadius = src.fRadius;
+
+	// A flat box still needs a non zero scale on its flat axis
+	auto scale = [](float lo, float hi) { return hi > lo ? (hi - lo) / 65535.0f : 1.0f; };
+	out.vQuantOffset = src.vMin;
+	out.vQuantScale = { scale(src.vMin.x, src.vMax.x), scale(src.vMin.y, src.vMax.y), scale(src.vMin.z, src.vMax.z), 0.0f };
+
+	auto quantize = [](float f, float lo, float step)
+	{
+		float q = (f - lo) / step + 0.5f;
+		return (uint16_t)(q < 0.0f ? 0.0f : q > 65535.0f ? 65535.0f : q);
+	};
+	out.verts.resize(src.nVerts);
+	for (uint32_t i = 0; i < src.nVerts; i++)
+	{
+		vec3d v = src.Vertex(i);
+		out.verts[i] = {
+			quantize(v.x, out.vQuantOffset.x, out.vQuantScale.x),
+			quantize(v.y, out.vQuantOffset.y, out.vQuantScale.y),
+			quantize(v.z, out.vQuantOffset.z, out.vQuantScale.z) };
+	}
+
+	out.blocks.clear();
+	out.indexData.clear();
+	for (uint32_t first = 0; first < 3 * src.nTris; first += 3 * INDEX_BLOCK_TRIS)
+	{
+		uint32_t count = 3 * src.nTris - first < 3 * INDEX_BLOCK_TRIS ? 3 * src.nTris - first : 3 * INDEX_BLOCK_TRIS;
+		const uint32_t* idx = src.pIndices + first;
+
+		packedIndexBlock block;
+		block.offset = (uint32_t)out.indexData.size();
+		block.base = *std::min_element(idx, idx + count);
+		uint32_t range = *std::max_element(idx, idx + count) - block.base;
+		block.bits = 0;
+		while (block.bits < 32 && (range >> block.bits) != 0)
+			block.bits++;
+		out.blocks.push_back(block);
+
+		// Written with the same 8 byte window the reader uses, so room for one
+		// more window is kept past the end until the next block overwrites it
+		size_t blockBytes = ((size_t)count * block.bits + 7) / 8;
+		out.indexData.resize(block.offset + blockBytes + sizeof(uint64_t), 0);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t bit = i * block.bits;
+			uint8_t* p = &out.indexData[block.offset + (bit >> 3)];
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			v |= (uint64_t)(idx[i] - block.base) << (bit & 7);
+			memcpy(p, &v, sizeof(v));
+		}
+		out.indexData.resize(block.offset + blockBytes);
+	}
+	out.indexData.resize(out.indexData.size() + sizeof(uint64_t), 0);
+}
@@ -0,0 +1,335 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <queue>
+#include <cmath>
+
+// Symmetric 4x4 error quadric of Garland & Heckbert's "Surface Simplification
+// Using Quadric Error Metrics". Sum of squared distances to a set of planes,
+// only the 10 unique terms are stored: a2 ab ac ad b2 bc bd c2 cd d2
+struct quadric
+{
+	double q[10] = { 0 };
+
+	void AddPlane(double a, double b, double c, double d, double w)
+	{
+		q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+		q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+		q[7] += w * c * c; q[8] += w * c * d;
+		q[9] += w * d * d;
+	}
+
+	void Add(const quadric& o)
+	{
+		for (int i = 0; i < 10; i++)
+			q[i] += o.q[i];
+	}
+
+	double Error(double x, double y, double z) const
+	{
+		return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+			+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+			+ q[7] * z * z + 2 * q[8] * z
+			+ q[9];
+	}
+
+	// Position with the least error, fails if the quadric is (nearly) singular
+	// eg: all planes are parallel, as on a flat patch
+	bool Optimal(double& x, double& y, double& z) const
+	{
+		double det = q[0] * (q[4] * q[7] - q[5] * q[5]) - q[1] * (q[1] * q[7] - q[5] * q[2]) + q[2] * (q[1] * q[5] - q[4] * q[2]);
+		double scale = q[0] + q[4] + q[7];
+		if (fabs(det) <= 1e-12 * scale * scale * scale)
+			return false;
+
+		// Cramer's rule on A v = -b
+		double bx = -q[3], by = -q[6], bz = -q[8];
+		x = (bx * (q[4] * q[7] - q[5] * q[5]) - q[1] * (by * q[7] - q[5] * bz) + q[2] * (by * q[5] - q[4] * bz)) / det;
+		y = (q[0] * (by * q[7] - bz * q[5]) - bx * (q[1] * q[7] - q[5] * q[2]) + q[2] * (q[1] * bz - by * q[2])) / det;
+		z = (q[0] * (q[4] * bz - q[5] * by) - q[1] * (q[1] * bz - by * q[2]) + bx * (q[1] * q[5] - q[4] * q[2])) / det;
+		return true;
+	}
+};
+
+// Boundary edges get an extra plane at right angles to their face, weighted
+// this much more than a face plane, so open edges and seams stay in place
+const double SIMPLIFY_BOUNDARY_WEIGHT = 100.0;
+
+// Reduce a mesh to about nTargetTris triangles by repeatedly collapsing the
+// edge whose merged vertex adds the least quadric error. Collapses that would
+// flip a neighbouring triangle over are skipped
+inline void Mesh_Simplify(const mesh& src, uint32_t nTargetTris, mesh& out)
+{
+	uint32_t nVerts = src.nVerts;
+	uint32_t nTris = src.nTris;
+
+	std::vector<vec3d> pos(nVerts);
+	for (uint32_t i = 0; i < nVerts; i++)
+		pos[i] = src.Vertex(i);
+	std::vector<uint32_t> tri(src.pIndices, src.pIndices + 3 * (size_t)nTris);
+	std::vector<bool> triAlive(nTris, true);
+	std::vector<bool> vertAlive(nVerts, true);
+	std::vector<uint32_t> version(nVerts, 0);	// Bumped whenever a vertex moves, to spot stale heap entries
+	std::vector<quadric> quadrics(nVerts);
+	std::vector<std::vector<uint32_t>> vertTris(nVerts);
+
+	auto faceNormal = [](const vec3d& p0, const vec3d& p1, const vec3d& p2, double n[3])
+	{
+		double ux = p1.x - p0.x, uy = p1.y - p0.y, uz = p1.z - p0.z;
+		double vx = p2.x - p0.x, vy = p2.y - p0.y, vz = p2.z - p0.z;
+		n[0] = uy * vz - uz * vy;
+		n[1] = uz * vx - ux * vz;
+		n[2] = ux * vy - uy * vx;
+		return sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	};
+
+	// Every vertex starts with the planes of the triangles around it, weighted by area
+	for (uint32_t t = 0; t < nTris; t++)
+	{
+		const uint32_t* v = &tri[3 * t];
+		double n[3];
+		double len = faceNormal(pos[v[0]], pos[v[1]], pos[v[2]], n);
+		for (int k = 0; k < 3; k++)
+			vertTris[v[k]].push_back(t);
+		if (len <= 0.0)
+			continue;
+
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		double d = -(n[0] * pos[v[0]].x + n[1] * pos[v[0]].y + n[2] * pos[v[0]].z);
+		for (int k = 0; k < 3; k++)
+			quadrics[v[k]].AddPlane(n[0], n[1], n[2], d, 0.5 * len);
+	}
+
+	// Find the unique edges, sorted by (min, max) vertex. An edge used by only one
+	// triangle is on a boundary
+	struct sEdge { uint64_t key; uint32_t t; };
+	std::vector<sEdge> edges;
+	edges.reserve(3 * (size_t)nTris);
+	for (uint32_t t = 0; t < nTris; t++)
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t a = tri[3 * t + k], b = tri[3 * t + (k + 1) % 3];
+			if (a > b) std::swap(a, b);
+			if (a != b)
+				edges.push_back({ ((uint64_t)a << 32) | b, t });
+		}
+	std::sort(edges.begin(), edges.end(), [](const sEdge& e1, const sEdge& e2) { return e1.key < e2.key; });
+
+	for (size_t i = 0; i < edges.size(); i++)
+	{
+		bool bFirst = i == 0 || edges[i - 1].key != edges[i].key;
+		bool bLast = i + 1 == edges.size() || edges[i + 1].key != edges[i].key;
+		if (!(bFirst && bLast))
+			continue;
+
+		uint32_t a = (uint32_t)(edges[i].key >> 32), b = (uint32_t)edges[i].key;
+		const uint32_t* v = &tri[3 * edges[i].t];
+		double n[3];
+		if (faceNormal(pos[v[0]], pos[v[1]], pos[v[2]], n) <= 0.0)
+			continue;
+
+		// Plane through the edge, at right angles to the face
+		double ex = pos[b].x - pos[a].x, ey = pos[b].y - pos[a].y, ez = pos[b].z - pos[a].z;
+		double bn[3] = { ey * n[2] - ez * n[1], ez * n[0] - ex * n[2], ex * n[1] - ey * n[0] };
+		double len = sqrt(bn[0] * bn[0] + bn[1] * bn[1] + bn[2] * bn[2]);
+		if (len <= 0.0)
+			continue;
+		bn[0] /= len; bn[1] /= len; bn[2] /= len;
+		double d = -(bn[0] * pos[a].x + bn[1] * pos[a].y + bn[2] * pos[a].z);
+		double w = SIMPLIFY_BOUNDARY_WEIGHT * (ex * ex + ey * ey + ez * ez);
+		quadrics[a].AddPlane(bn[0], bn[1], bn[2], d, w);
+		quadrics[b].AddPlane(bn[0], bn[1], bn[2], d, w);
+	}
+
+	// Candidate collapses, cheapest first
+	struct sCollapse
+	{
+		double cost;
+		uint32_t v0, v1;
+		uint32_t ver0, ver1;
+		vec3d target;
+		bool operator>(const sCollapse& o) const { return cost > o.cost; }
+	};
+	std::priority_queue<sCollapse, std::vector<sCollapse>, std::greater<sCollapse>> heap;
+
+	auto pushCollapse = [&](uint32_t v0, uint32_t v1)
+	{
+		quadric q = quadrics[v0];
+		q.Add(quadrics[v1]);
+
+		sCollapse c;
+		c.v0 = v0; c.v1 = v1;
+		c.ver0 = version[v0]; c.ver1 = version[v1];
+
+		double x, y, z;
+		if (q.Optimal(x, y, z))
+		{
+			c.target.x = (float)x; c.target.y = (float)y; c.target.z = (float)z;
+			c.cost = q.Error(x, y, z);
+		}
+		else
+		{
+			// Fall back to the better of either end or the middle
+			const vec3d& p0 = pos[v0];
+			const vec3d& p1 = pos[v1];
+			vec3d mid = { (p0.x + p1.x) * 0.5f, (p0.y + p1.y) * 0.5f, (p0.z + p1.z) * 0.5f };
+			const vec3d* options[3] = { &p0, &p1, &mid };
+			c.cost = -1.0;
+			for (const vec3d* o : options)
+			{
+				double e = q.Error(o->x, o->y, o->z);
+				if (c.cost < 0.0 || e < c.cost) { c.cost = e; c.target = *o; }
+			}
+		}
+		if (c.cost < 0.0)
+			c.cost = 0.0;
+		heap.push(c);
+	};
+
+	for (size_t i = 0; i < edges.size(); i++)
+		if (i == 0 || edges[i - 1].key != edges[i].key)
+			pushCollapse((uint32_t)(edges[i].key >> 32), (uint32_t)edges[i].key);
+
+	// Would moving vertex a to target flip any triangle that survives the collapse of a-b?
+	auto flips = [&](uint32_t a, uint32_t b, const vec3d& target)
+	{
+		for (uint32_t t : vertTris[a])
+		{
+			if (!triAlive[t])
+				continue;
+			const uint32_t* v = &tri[3 * t];
+			if (v[0] == b || v[1] == b || v[2] == b)
+				continue;
+
+			vec3d p[3] = { pos[v[0]], pos[v[1]], pos[v[2]] };
+			double nOld[3], nNew[3];
+			double lenOld = faceNormal(p[0], p[1], p[2], nOld);
+			for (int k = 0; k < 3; k++)
+				if (v[k] == a) p[k] = target;
+			double lenNew = faceNormal(p[0], p[1], p[2], nNew);
+			if (lenOld > 0.0 && nOld[0] * nNew[0] + nOld[1] * nNew[1] + nOld[2] * nNew[2] <= 0.01 * lenOld * lenNew)
+				return true;
+		}
+		return false;
+	};
+
+	std::vector<uint32_t> mark(nVerts, 0);
+	uint32_t nCollapses = 0;
+	uint32_t nLiveTris = nTris;
+
+	while (nLiveTris > nTargetTris && !heap.empty())
+	{
+		sCollapse c = heap.top();
+		heap.pop();
+
+		uint32_t v0 = c.v0, v1 = c.v1;
+		if (!vertAlive[v0] || !vertAlive[v1] || version[v0] != c.ver0 || version[v1] != c.ver1)
+			continue;
+		if (flips(v0, v1, c.target) || flips(v1, v0, c.target))
+			continue;
+
+		// Merge v1 into v0
+		pos[v0] = c.target;
+		quadrics[v0].Add(quadrics[v1]);
+		vertAlive[v1] = false;
+		version[v0]++;
+
+		for (uint32_t t : vertTris[v1])
+		{
+			if (!triAlive[t])
+				continue;
+			uint32_t* v = &tri[3 * t];
+			if (v[0] == v0 || v[1] == v0 || v[2] == v0)
+			{
+				// Triangles along the collapsed edge become degenerate
+				triAlive[t] = false;
+				nLiveTris--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+				if (v[k] == v1) v[k] = v0;
+			vertTris[v0].push_back(t);
+		}
+		std::vector<uint32_t>().swap(vertTris[v1]);
+
+		// Drop dead triangles from v0 and queue new collapses with all its neighbours
+		std::vector<uint32_t>& around = vertTris[v0];
+		around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t t) { return !triAlive[t]; }), around.end());
+
+		nCollapses++;
+		mark[v0] = nCollapses;
+		for (uint32_t t : around)
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t n = tri[3 * t + k];
+				if (mark[n] != nCollapses)
+				{
+					mark[n] = nCollapses;
+					pushCollapse(v0, n);
+				}
+			}
+	}
+
+	// Compact the surviving vertices and triangles, keeping their original order
+	std::vector<uint32_t> remap(nVerts, UINT32_MAX);
+	for (uint32_t t = 0; t < nTris; t++)
+		if (triAlive[t])
+			for (int k = 0; k < 3; k++)
+				remap[tri[3 * t + k]] = 0;
+
+	std::vector<vec3d> outVerts;
+	for (uint32_t i = 0; i < nVerts; i++)
+		if (remap[i] == 0)
+		{
+			remap[i] = (uint32_t)outVerts.size();
+			outVerts.push_back(pos[i]);
+		}
+
+	std::vector<uint32_t> outIndices;
+	outIndices.reserve(3 * (size_t)nLiveTris);
+	for (uint32_t t = 0; t < nTris; t++)
+		if (triAlive[t])
+			for (int k = 0; k < 3; k++)
+				outIndices.push_back(remap[tri[3 * t + k]]);
+
+	Mesh_OptimizeVertexCache(outIndices, (uint32_t)outVerts.size());
+	Mesh_OptimizeVertexFetch(outVerts, outIndices);
+
+	out.SetData(outVerts, std::move(outIndices));
+}
+
+// Levels of detail stop halving once they get this small
+const uint32_t LOD_MIN_TRIS = 256;
+
+// Fill lods with a chain of simpler versions of full, each with about half the
+// triangles of the one before. Levels are baked to <name>.lod<N>.mesh next to
+// the object file and mapped from there while the object file is unchanged
+inline bool Mesh_LoadLODs(const std::string& filename, const mesh& full, std::vector<mesh>& lods, int nMaxLevels = 4)
+{
+	uint64_t sourceSize, sourceTime;
+	if (!GetFileStamp(filename, sourceSize, sourceTime))
+		return false;
+
+	lods.clear();
+	lods.reserve(nMaxLevels);
+	const mesh* prev = &full;
+	for (int level = 1; level <= nMaxLevels && prev->nTris / 2 >= LOD_MIN_TRIS; level++)
+	{
+		mesh lod;
+		std::string cacheFile = mesh::CacheFileName(filename, ".lod" + std::to_string(level));
+		if (!lod.LoadFromCacheFile(cacheFile, sourceSize, sourceTime))
+		{
+			Mesh_Simplify(*prev, prev->nTris / 2, lod);
+			lod.SaveToCacheFile(cacheFile, sourceSize, sourceTime);
+		}
+
+		// Simplification got stuck, further levels wouldn't get any smaller
+		if (lod.nTris >= prev->nTris)
+			break;
+
+		lods.push_back(std::move(lod));
+		prev = &lods.back();
+	}
+	return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+
+// Hand written scanners for the Wavefront OBJ text format. They work directly
+// on a [p, end) character range (e.g. a memory-mapped file) and never allocate,
+// so there's no line length limit and no iostream overhead per value
+namespace obj
+{
+	inline bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+	inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+	inline const char* SkipSpace(const char* p, const char* end)
+	{
+		while (p < end && IsSpace(*p)) p++;
+		return p;
+	}
+
+	// Returns pointer to the first character of the next line
+	inline const char* SkipLine(const char* p, const char* end)
+	{
+		while (p < end && *p != '\n') p++;
+		return p < end ? p + 1 : end;
+	}
+
+	// Parses a signed integer. Returns p unchanged if there are no digits
+	inline const char* ParseInt(const char* p, const char* end, int& out)
+	{
+		const char* start = p;
+		bool neg = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			neg = (*p++ == '-');
+
+		if (p == end || !IsDigit(*p))
+			return start;
+
+		int v = 0;
+		while (p < end && IsDigit(*p))
+			v = v * 10 + (*p++ - '0');
+		out = neg ? -v : v;
+		return p;
+	}
+
+	// Parses a decimal float of the form [+-]digits[.digits][(e|E)[+-]digits].
+	// Digits are accumulated into a 64 bit mantissa and scaled by an exact power
+	// of ten, which is correctly rounded for the short values OBJ exporters write
+	inline const char* ParseFloat(const char* p, const char* end, float& out)
+	{
+		static const double pow10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		const char* start = p;
+		bool neg = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			neg = (*p++ == '-');
+
+		uint64_t mantissa = 0;
+		int digits = 0;		// Significant digits kept in mantissa
+		int exponent = 0;
+		bool any = false;
+
+		for (; p < end && IsDigit(*p); p++)
+		{
+			any = true;
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+			else exponent++;
+		}
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && IsDigit(*p); p++)
+			{
+				any = true;
+				if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+			}
+		}
+		if (!any)
+			return start;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			int e = 0;
+			const char* q = ParseInt(p + 1, end, e);
+			if (q != p + 1)
+			{
+				exponent += e;
+				p = q;
+			}
+		}
+
+		double v = (double)mantissa;
+		while (exponent > 22) { v *= 1e22; exponent -= 22; }
+		while (exponent < -22) { v /= 1e22; exponent += 22; }
+		v = exponent < 0 ? v / pow10[-exponent] : v * pow10[exponent];
+
+		out = (float)(neg ? -v : v);
+		return p;
+	}
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "MeshPacked.h"
+#include "Raster.h"
+#include "Simd.h"
+
+#include <cstring>
+#include <vector>
+
+// Triangles are grouped in mesh order into clusters of CLUSTER_TRIS, the same
+// as a packed mesh's index blocks, each with a bounding box so that all of its
+// triangles can be culled at once. Reordering at load time (MeshOptimize.h)
+// keeps nearby triangles together, so the boxes are reasonably tight
+const uint32_t CLUSTER_TRIS = INDEX_BLOCK_TRIS;
+
+// Object space bounding box of triangles CLUSTER_TRIS * i onwards
+struct meshCluster
+{
+	vec3d vMin, vMax;
+};
+
+inline void Cluster_Grow(meshCluster& c, const vec3d& p, bool bFirst)
+{
+	if (bFirst)
+	{
+		c.vMin = p;
+		c.vMax = p;
+		return;
+	}
+	if (p.x < c.vMin.x) c.vMin.x = p.x;
+	if (p.y < c.vMin.y) c.vMin.y = p.y;
+	if (p.z < c.vMin.z) c.vMin.z = p.z;
+	if (p.x > c.vMax.x) c.vMax.x = p.x;
+	if (p.y > c.vMax.y) c.vMax.y = p.y;
+	if (p.z > c.vMax.z) c.vMax.z = p.z;
+}
+
+inline void Mesh_BuildClusters(const mesh& m, std::vector<meshCluster>& clusters)
+{
+	clusters.resize((m.nTris + CLUSTER_TRIS - 1) / CLUSTER_TRIS);
+	for (uint32_t i = 0; i < 3 * m.nTris; i++)
+		Cluster_Grow(clusters[i / (3 * CLUSTER_TRIS)], m.Vertex(m.pIndices[i]), i % (3 * CLUSTER_TRIS) == 0);
+}
+
+inline void Mesh_BuildClusters(const meshPacked& m, std::vector<meshCluster>& clusters)
+{
+	static_assert(CLUSTER_TRIS == INDEX_BLOCK_TRIS, "A packed mesh's clusters are its index blocks");
+	clusters.resize(m.blocks.size());
+	for (uint32_t i = 0; i < 3 * m.nTris; i++)
+	{
+		uint32_t nBlock = i / (3 * INDEX_BLOCK_TRIS);
+		uint32_t idx = Mesh_ReadIndex(m.indexData.data(), m.blocks[nBlock], i % (3 * INDEX_BLOCK_TRIS));
+		Cluster_Grow(clusters[nBlock], m.Dequantize(m.verts[idx]), i % (3 * INDEX_BLOCK_TRIS) == 0);
+	}
+}
+
+// Hierarchical depth (Hi-Z) of what has been drawn so far. Level 0 holds the
+// farthest depth in each BLOCK x BLOCK block of cells, each following level the
+// farthest of 2 x 2 texels of the one before, down to a single texel. Depths
+// are 1 / w like the depth buffer, so the farthest is the smallest and 0 means
+// part of the block is empty
+struct depthPyramid
+{
+	static const int BLOCK = 8;
+
+	struct level
+	{
+		int nWidth, nHeight;
+		std::vector<float> depth;
+	};
+	std::vector<level> levels;
+	std::vector<float> columns;	// Farthest depth in each column of the block row being built
+
+	void Build(const float* pDepth, int nWidth, int nHeight)
+	{
+		int nLevelWidth = (nWidth + BLOCK - 1) / BLOCK, nLevelHeight = (nHeight + BLOCK - 1) / BLOCK;
+		size_t nLevels = 1;
+		for (int w = nLevelWidth, h = nLevelHeight; w > 1 || h > 1; w = (w + 1) / 2, h = (h + 1) / 2)
+			nLevels++;
+		levels.resize(nLevels);
+
+		// Level 0 a row of blocks at a time: the farthest of each column of the
+		// block rows first, which is a straight pass over the depth buffer, then
+		// across each block
+		level& l0 = levels[0];
+		l0.nWidth = nLevelWidth;
+		l0.nHeight = nLevelHeight;
+		l0.depth.resize((size_t)nLevelWidth * nLevelHeight);
+		columns.resize(nWidth);
+		for (int by = 0; by < nLevelHeight; by++)
+		{
+			int y1 = by * BLOCK, y2 = y1 + BLOCK < nHeight ? y1 + BLOCK : nHeight;
+			float* pColumns = columns.data();
+			memcpy(pColumns, pDepth + (size_t)y1 * nWidth, sizeof(float) * nWidth);
+			for (int y = y1 + 1; y < y2; y++)
+			{
+				const float* pRow = pDepth + (size_t)y * nWidth;
+				int x = 0;
+#if HAMRO_SIMD
+				// _mm_min_ps picks the same as the comparison below
+				for (; x + 4 <= nWidth; x += 4)
+					_mm_storeu_ps(pColumns + x, _mm_min_ps(_mm_loadu_ps(pRow + x), _mm_loadu_ps(pColumns + x)));
+#endif
+				for (; x < nWidth; x++)
+					pColumns[x] = pRow[x] < pColumns[x] ? pRow[x] : pColumns[x];
+			}
+			for (int bx = 0; bx < nLevelWidth; bx++)
+			{
+				int x1 = bx * BLOCK, x2 = x1 + BLOCK < nWidth ? x1 + BLOCK : nWidth;
+				float fMin = pColumns[x1];
+				for (int x = x1 + 1; x < x2; x++)
+					fMin = pColumns[x] < fMin ? pColumns[x] : fMin;
+				l0.depth[(size_t)by * nLevelWidth + bx] = fMin;
+			}
+		}
+
+		for (size_t i = 1; i < nLevels; i++)
+		{
+			const level& src = levels[i - 1];
+			level& dst = levels[i];
+			dst.nWidth = (src.nWidth + 1) / 2;
+			dst.nHeight = (src.nHeight + 1) / 2;
+			dst.depth.resize((size_t)dst.nWidth * dst.nHeight);
+			for (int y = 0; y < dst.nHeight; y++)
+				for (int x = 0; x < dst.nWidth; x++)
+				{
+					int sx = 2 * x, sy = 2 * y;
+					int sx2 = sx + 1 < src.nWidth ? sx + 1 : sx, sy2 = sy + 1 < src.nHeight ? sy + 1 : sy;
+					float a = src.depth[sy * src.nWidth + sx], b = src.depth[sy * src.nWidth + sx2];
+					float c = src.depth[sy2 * src.nWidth + sx], d = src.depth[sy2 * src.nWidth + sx2];
+					float fMin = a < b ? a : b;
+					fMin = c < fMin ? c : fMin;
+					dst.depth[y * dst.nWidth + x] = d < fMin ? d : fMin;
+				}
+		}
+	}
+
+	// True if every cell in rc, which must be on screen and not empty, already
+	// holds something nearer than fNearest, so nothing at fNearest or farther
+	// can show there. Looks at the first level where rc spans at most 4 x 4
+	// texels, whose blocks may reach outside rc, which only makes it say
+	// hidden less often
+	bool Hidden(const rasterRect& rc, float fNearest) const
+	{
+		int x1 = rc.nLeft / BLOCK, x2 = (rc.nRight - 1) / BLOCK;
+		int y1 = rc.nTop / BLOCK, y2 = (rc.nBottom - 1) / BLOCK;
+		size_t i = 0;
+		while (i + 1 < levels.size() && (x2 - x1 >= 4 || y2 - y1 >= 4))
+		{
+			x1 /= 2; x2 /= 2;
+			y1 /= 2; y2 /= 2;
+			i++;
+		}
+
+		const level& l = levels[i];
+		for (int y = y1; y <= y2; y++)
+			for (int x = x1; x <= x2; x++)
+				if (l.depth[y * l.nWidth + x] <= fNearest)
+					return false;
+		return true;
+	}
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Present.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+// The console cell and key codes of windows.h, so the same drawing and input
+// code runs on every platform
+struct CHAR_INFO
+{
+	union
+	{
+		wchar_t UnicodeChar;
+		char AsciiChar;
+	} Char;
+	unsigned short Attributes;
+};
+
+enum VIRTUAL_KEY
+{
+	VK_BACK = 0x08,
+	VK_TAB = 0x09,
+	VK_RETURN = 0x0D,
+	VK_ESCAPE = 0x1B,
+	VK_SPACE = 0x20,
+	VK_LEFT = 0x25,
+	VK_UP = 0x26,
+	VK_RIGHT = 0x27,
+	VK_DOWN = 0x28,
+};
+#endif
+
+// Keyboard, mouse and focus as a platform last saw them. hamroGraphics keeps
+// one across frames and turns it into pressed, held and released states
+struct platformInput
+{
+	bool bKeys[256] = {};	// Down or not, by windows.h virtual key code
+	bool bMouse[5] = {};	// Left, right and middle buttons, then two extra
+	int nMouseX = 0, nMouseY = 0;
+	bool bFocused = true;
+	bool bRedraw = false;	// What was on screen may be lost, so present the next frame in full
+};
+
+// What hamroGraphics needs from the system it runs on: a screen of character
+// cells to present frames to, input, and a title
+class consolePlatform
+{
+public:
+	virtual ~consolePlatform() {}
+
+	// Take over the console with a screen of nWidth x nHeight cells, each
+	// nFontWidth x nFontHeight pixels where the font can be set. Platforms that
+	// can't change the console's size take a width or height of 0 to mean as
+	// many cells as there are. Reports what went wrong and returns false if the
+	// screen can't be had. pfnClose is called when the user closes the console,
+	// perhaps on another thread or in a signal handler, so it must only ask the
+	// game to stop
+	virtual bool Create(int& nWidth, int& nHeight, int nFontWidth, int nFontHeight, void (*pfnClose)()) = 0;
+
+	// Give the console back the way it was found. Safe to call more than once
+	virtual void Restore() = 0;
+
+	// Bring input up to date
+	virtual void ReadInput(platformInput& input) = 0;
+
+	// Time the game is told passed since the last frame, given what did
+	virtual float FrameTime(float fMeasured) { return fMeasured; }
+
+	// False if frames are never shown, so they needn't be converted for Present,
+	// which is then not called
+	virtual bool WantsFrames() { return true; }
+
+	// Show the cells of the runs, taken from pCells, a frame of nWidth x
+	// nHeight cells row by row. Cells outside the runs are unchanged since the
+	// last frame presented (see frameDelta)
+	virtual void Present(const CHAR_INFO* pCells, int nWidth, int nHeight, const std::vector<dirtyRun>& runs) = 0;
+
+	// Shown in the window's title bar, from the next Present on
+	virtual void SetTitle(const std::wstring& title) = 0;
+};
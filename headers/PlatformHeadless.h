@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "Platform.h"
+#include "colors.h"
+
+// No console at all: frames are drawn into memory at any size and, unless
+// asked for, never converted or shown, so what is timed is the engine alone.
+// Frames can be written out as images instead, one pixel a cell, for
+// comparing the output of two builds. Each frame is taken to last FRAME_TIME,
+// whatever it really took, so every run draws the same frames. Runs for
+// nFrames frames, or until stopped if that is 0, and prints the frame rate
+// when done
+class headlessScreen : public consolePlatform
+{
+public:
+	// strImages is a printf pattern taking the frame number, such as
+	// "frames/%05d.ppm". Files ending .pgm are written in grey, anything else
+	// in color. Empty, or not a ValidImagePattern, writes nothing
+	explicit headlessScreen(int nFrames = 0, const std::string& strImages = "")
+		: m_nFrames(nFrames), m_strImages(ValidImagePattern(strImages) ? strImages : "")
+	{
+		m_bGrey = m_strImages.size() >= 4 && m_strImages.compare(m_strImages.size() - 4, 4, ".pgm") == 0;
+	}
+
+	// The pattern is handed to printf, so it must take the frame number and
+	// nothing else: exactly one %d, with flags and a width if wanted, and no
+	// other % but %%
+	static bool ValidImagePattern(const std::string& strImages)
+	{
+		int nConversions = 0;
+		for (size_t i = 0; i < strImages.size(); i++)
+		{
+			if (strImages[i] != '%')
+				continue;
+			i++;
+			if (i < strImages.size() && strImages[i] == '%')
+				continue;
+			while (i < strImages.size() && strchr("-+ 0#", strImages[i]))
+				i++;
+			while (i < strImages.size() && strImages[i] >= '0' && strImages[i] <= '9')
+				i++;
+			if (i >= strImages.size() || (strImages[i] != 'd' && strImages[i] != 'i'))
+				return false;
+			nConversions++;
+		}
+		return nConversions == 1;
+	}
+
+	bool Create(int& nWidth, int& nHeight, int nFontWidth, int nFontHeight, void (*pfnClose)()) override
+	{
+		(void)nFontWidth;
+		(void)nFontHeight;
+		if (nWidth <= 0 || nHeight <= 0)
+		{
+			fprintf(stderr, "ERROR: Screen Width and Height must be given\n");
+			return false;
+		}
+		m_pfnClose = pfnClose;
+		m_nFrame = 0;
+		m_bActive = true;
+		return true;
+	}
+
+	void Restore() override
+	{
+		if (!m_bActive)
+			return;
+		m_bActive = false;
+		if (m_nFrame > 1)
+		{
+			double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tStart).count();
+			printf("%d frames in %.3f s, %.2f ms a frame, %.1f FPS\n", m_nFrame - 1, fSeconds,
+				1000.0 * fSeconds / (m_nFrame - 1), (m_nFrame - 1) / fSeconds);
+		}
+		if (!m_title.empty())
+			printf("%ls\n", m_title.c_str());
+	}
+
+	// Nothing is ever pressed. Frames are counted from here, which the game
+	// thread calls once at the start of each
+	void ReadInput(platformInput& input) override
+	{
+		(void)input;
+		m_nFrame++;
+		if (m_nFrame == 2)
+			m_tStart = std::chrono::steady_clock::now();	// Leave out the first frame, which may wait for models to load
+		if (m_nFrames > 0 && m_nFrame >= m_nFrames && m_pfnClose)
+			m_pfnClose();	// This frame is the last
+	}
+
+	float FrameTime(float fMeasured) override
+	{
+		(void)fMeasured;
+		return FRAME_TIME;
+	}
+
+	bool WantsFrames() override
+	{
+		return !m_strImages.empty();
+	}
+
+	// pCells always holds the whole frame, since only cells that haven't
+	// changed are left out of the runs
+	void Present(const CHAR_INFO* pCells, int nWidth, int nHeight, const std::vector<dirtyRun>& runs) override
+	{
+		(void)runs;
+		if (m_strImages.empty())
+			return;
+
+		char szFile[512];
+		snprintf(szFile, sizeof(szFile), m_strImages.c_str(), m_nFrame);
+		FILE* f = fopen(szFile, "wb");
+		if (!f)
+		{
+			fprintf(stderr, "ERROR: Can't write %s, no more images will be\n", szFile);
+			m_strImages.clear();
+			return;
+		}
+
+		int nChannels = m_bGrey ? 1 : 3;
+		fprintf(f, "P%d\n%d %d\n255\n", m_bGrey ? 5 : 6, nWidth, nHeight);
+		m_vecPixels.resize((size_t)nWidth * nChannels);
+		for (int y = 0; y < nHeight; y++)
+		{
+			unsigned char* p = m_vecPixels.data();
+			for (int x = 0; x < nWidth; x++, p += nChannels)
+				CellColour(pCells[(size_t)y * nWidth + x], p, m_bGrey);
+			fwrite(m_vecPixels.data(), 1, m_vecPixels.size(), f);
+		}
+		fclose(f);
+	}
+
+	// Kept to be printed at the end, since the game may show figures in it
+	void SetTitle(const std::wstring& title) override
+	{
+		m_title = title;
+	}
+
+	// What a cell looks like as a pixel: its foreground and background colors
+	// mixed by how much of the cell the symbol covers. Grey is the luma of that
+	static void CellColour(const CHAR_INFO& cell, unsigned char* p, bool bGrey)
+	{
+		int nCover;	// Out of 4
+		switch (cell.Char.UnicodeChar)
+		{
+		case PIXEL_SOLID: nCover = 4; break;
+		case PIXEL_THREEQUARTERS: nCover = 3; break;
+		case PIXEL_HALF: nCover = 2; break;
+		case PIXEL_QUARTER: nCover = 1; break;
+		case 0: case L' ': nCover = 0; break;
+		default: nCover = 2; break;
+		}
+		const unsigned char* fg = GetColourRGB(cell.Attributes & 0x0F);
+		const unsigned char* bg = GetColourRGB((cell.Attributes >> 4) & 0x0F);
+		int rgb[3];
+		for (int k = 0; k < 3; k++)
+			rgb[k] = (bg[k] * (4 - nCover) + fg[k] * nCover + 2) / 4;
+		if (bGrey)
+			p[0] = (unsigned char)((rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29 + 128) >> 8);
+		else
+		{
+			p[0] = (unsigned char)rgb[0];
+			p[1] = (unsigned char)rgb[1];
+			p[2] = (unsigned char)rgb[2];
+		}
+	}
+
+private:
+	static constexpr float FRAME_TIME = 1.0f / 30.0f;
+
+	int m_nFrames;
+	std::string m_strImages;
+	bool m_bGrey;
+	int m_nFrame = 0;	// Frames begun
+	bool m_bActive = false;
+	void (*m_pfnClose)() = nullptr;
+	std::chrono::steady_clock::time_point m_tStart;
+	std::vector<unsigned char> m_vecPixels;	// One row of the image
+	std::wstring m_title;	// The last one set
+};
+
+// Define our static variables
+constexpr float headlessScreen::FRAME_TIME;
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "Platform.h"
+#include "colors.h"
+
+// A terminal understanding ANSI (xterm) escape sequences, as on Linux. Each
+// frame is turned into cursor moves, colors and UTF-8 symbols in one buffer
+// and handed over in a single write(). Colors are the 16 of the Windows
+// console, sent as 24 bit RGB when COLORTERM says the terminal takes it and as
+// the nearest of the 256 xterm colors otherwise. Keys are read in raw mode
+class ansiTerminal : public consolePlatform
+{
+public:
+	ansiTerminal()
+	{
+		const char* szColorTerm = getenv("COLORTERM");
+		m_bTrueColor = szColorTerm && (strstr(szColorTerm, "truecolor") || strstr(szColorTerm, "24bit"));
+		for (int i = 0; i < 256; i++)
+			m_sgr[i] = ColorSequence(i & 0x0F, i >> 4);
+	}
+
+	bool Create(int& nWidth, int& nHeight, int nFontWidth, int nFontHeight, void (*pfnClose)()) override
+	{
+		// A terminal's font is its own business
+		(void)nFontWidth;
+		(void)nFontHeight;
+
+		if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+			return Error("Not a terminal");
+
+		winsize ws;
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0)
+			return Error("TIOCGWINSZ");
+		if (nWidth <= 0)
+			nWidth = ws.ws_col;
+		if (nHeight <= 0)
+			nHeight = ws.ws_row;
+		if (nHeight > ws.ws_row)
+			return Error("Screen Height Too Big for the terminal", false);
+		if (nWidth > ws.ws_col)
+			return Error("Screen Width Too Big for the terminal", false);
+
+		// Raw mode: keys arrive as they are pressed, without echo, and reads
+		// return at once with whatever there is. Ctrl+C arrives as a key too,
+		// so it closes the game the same way as everything else
+		if (tcgetattr(STDIN_FILENO, &m_termOriginal) != 0)
+			return Error("tcgetattr");
+		termios raw = m_termOriginal;
+		raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+		raw.c_oflag &= ~OPOST;
+		raw.c_cflag |= CS8;
+		raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0)
+			return Error("tcsetattr");
+
+		m_pfnClose = pfnClose;
+		m_bResized = 0;
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SignalHandler;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, &m_saOriginal[0]);
+		sigaction(SIGTERM, &sa, &m_saOriginal[1]);
+		sigaction(SIGHUP, &sa, &m_saOriginal[2]);
+		sigaction(SIGWINCH, &sa, &m_saOriginal[3]);
+
+		// Alternate screen, no cursor, no wrapping at the right edge, mouse
+		// tracking with SGR coordinates and focus reports
+		m_out = "\x1b[?1049h\x1b[?25l\x1b[?7l\x1b[?1003h\x1b[?1006h\x1b[?1004h\x1b[0m\x1b[2J";
+		Flush();
+		m_nAttributes = -1;
+		m_bActive = true;
+		return true;
+	}
+
+	void Restore() override
+	{
+		if (!m_bActive)
+			return;
+		m_bActive = false;
+		m_out = "\x1b[0m\x1b[?1004l\x1b[?1006l\x1b[?1003l\x1b[?7h\x1b[?25h\x1b[?1049l";
+		Flush();
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &m_termOriginal);
+		sigaction(SIGINT, &m_saOriginal[0], nullptr);
+		sigaction(SIGTERM, &m_saOriginal[1], nullptr);
+		sigaction(SIGHUP, &m_saOriginal[2], nullptr);
+		sigaction(SIGWINCH, &m_saOriginal[3], nullptr);
+	}
+
+	~ansiTerminal()
+	{
+		Restore();
+	}
+
+	// A terminal only sends keys as they are typed, repeating while they are
+	// held, and never says when they are let go. So a key counts as held until
+	// its repeats stop: KEY_REPEAT_GAP after the last one, or KEY_FIRST_DELAY
+	// after the first press, which covers the wait before a held key starts
+	// repeating
+	void ReadInput(platformInput& input) override
+	{
+		if (m_bResized)
+		{
+			m_bResized = 0;
+			input.bRedraw = true;
+		}
+
+		double fNow = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		unsigned char buf[256];
+		ssize_t n;
+		bool bRead = false;
+		while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+		{
+			m_pending.insert(m_pending.end(), buf, buf + n);
+			bRead = true;
+		}
+		int nUsed = Parse(m_pending.data(), (int)m_pending.size(), fNow, input);
+		m_pending.erase(m_pending.begin(), m_pending.begin() + nUsed);
+
+		// What is left is the start of an escape sequence. If nothing more came
+		// since the last frame, a lone ESC was the Escape key and anything
+		// longer is never going to finish
+		if (!bRead && !m_pending.empty())
+		{
+			if (m_pending.size() == 1)
+				KeyDown(VK_ESCAPE, fNow, input);
+			m_pending.clear();
+		}
+
+		for (int i = 0; i < 256; i++)
+		{
+			sKeyTimes& k = m_keyTimes[i];
+			if (input.bKeys[i] && fNow - k.fLast > (k.fLast == k.fFirst ? KEY_FIRST_DELAY : KEY_REPEAT_GAP))
+				input.bKeys[i] = false;
+		}
+	}
+
+	// One cursor move for each run, or a move to the right for one on the same
+	// row as the last, and a color change only where the colors differ from the
+	// cell before
+	void Present(const CHAR_INFO* pCells, int nWidth, int nHeight, const std::vector<dirtyRun>& runs) override
+	{
+		(void)nHeight;
+		char szMove[32];
+		int nRow = -1, nCol = 0;
+		for (auto& run : runs)
+		{
+			if (run.y == nRow)
+				snprintf(szMove, sizeof(szMove), "\x1b[%dC", run.x1 - nCol);
+			else
+				snprintf(szMove, sizeof(szMove), "\x1b[%d;%dH", run.y + 1, run.x1 + 1);
+			m_out += szMove;
+
+			const CHAR_INFO* pCell = pCells + (size_t)run.y * nWidth + run.x1;
+			for (int x = run.x1; x <= run.x2; x++, pCell++)
+			{
+				int nAttributes = pCell->Attributes & 0xFF;
+				uint32_t c = (uint32_t)pCell->Char.UnicodeChar;
+				if (c == PIXEL_SOLID && nAttributes != m_nAttributes)
+				{
+					// A space on the block's color is one byte to the block's
+					// three, and may need no color change
+					int nFill = nAttributes & 0x0F;
+					nAttributes = m_nAttributes >= 0 && (m_nAttributes >> 4) == nFill ? m_nAttributes : nFill * 0x11;
+					c = ' ';
+				}
+				if (nAttributes != m_nAttributes)
+				{
+					m_out += m_sgr[nAttributes];
+					m_nAttributes = nAttributes;
+				}
+				AppendUtf8(c);
+			}
+			nRow = run.y;
+			nCol = run.x2 + 1;
+		}
+		Flush();
+	}
+
+	// Sent with the next frame
+	void SetTitle(const std::wstring& title) override
+	{
+		m_out += "\x1b]0;";
+		for (wchar_t c : title)
+			if (c >= 0x20)
+				AppendUtf8((uint32_t)c);
+		m_out += "\x07";
+	}
+
+private:
+	static constexpr double KEY_FIRST_DELAY = 0.55;
+	static constexpr double KEY_REPEAT_GAP = 0.1;
+
+	struct sKeyTimes
+	{
+		double fFirst, fLast;
+	} m_keyTimes[256] = {};
+
+	bool m_bActive = false;
+	bool m_bTrueColor;
+	termios m_termOriginal;
+	struct sigaction m_saOriginal[4];
+	std::string m_out;	// What the next write sends
+	std::vector<unsigned char> m_pending;	// Input read but not parsed yet, an escape sequence cut short
+	int m_nAttributes = -1;	// Console attributes the terminal is drawing with, -1 if not known
+	std::string m_sgr[256];	// Escape sequence setting each combination of console attributes
+
+	static void (*m_pfnClose)();
+	static volatile sig_atomic_t m_bResized;
+
+	bool Error(const char* msg, bool bErrno = true)
+	{
+		fprintf(stderr, "ERROR: %s\n\t%s\n", msg, bErrno ? strerror(errno) : "");
+		return false;
+	}
+
+	static void SignalHandler(int nSignal)
+	{
+		if (nSignal == SIGWINCH)
+			m_bResized = 1;
+		else if (m_pfnClose)
+			m_pfnClose();
+	}
+
+	// Everything buffered, in as few writes as the terminal takes it
+	void Flush()
+	{
+		const char* p = m_out.data();
+		size_t nLeft = m_out.size();
+		while (nLeft > 0)
+		{
+			ssize_t n = write(STDOUT_FILENO, p, nLeft);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			p += n;
+			nLeft -= n;
+		}
+		m_out.clear();
+	}
+
+	void AppendUtf8(uint32_t c)
+	{
+		if (c < 0x20)
+			c = ' ';
+		if (c < 0x80)
+			m_out += (char)c;
+		else if (c < 0x800)
+		{
+			m_out += (char)(0xC0 | (c >> 6));
+			m_out += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			m_out += (char)(0xE0 | (c >> 12));
+			m_out += (char)(0x80 | ((c >> 6) & 0x3F));
+			m_out += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			m_out += (char)(0xF0 | (c >> 18));
+			m_out += (char)(0x80 | ((c >> 12) & 0x3F));
+			m_out += (char)(0x80 | ((c >> 6) & 0x3F));
+			m_out += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	// Nearest of the xterm colors 16 to 255, a 6 x 6 x 6 cube and a grey ramp,
+	// which unlike 0 to 15 don't change with the terminal's theme
+	static int Xterm256(const unsigned char* rgb)
+	{
+		static const int levels[6] = { 0, 95, 135, 175, 215, 255 };
+		int nBest = 16;
+		long nBestDist = 1L << 30;
+		for (int i = 16; i < 256; i++)
+		{
+			int r, g, b;
+			if (i < 232)
+			{
+				r = levels[(i - 16) / 36];
+				g = levels[(i - 16) / 6 % 6];
+				b = levels[(i - 16) % 6];
+			}
+			else
+				r = g = b = 8 + 10 * (i - 232);
+			long nDist = (long)(r - rgb[0]) * (r - rgb[0]) + (long)(g - rgb[1]) * (g - rgb[1]) + (long)(b - rgb[2]) * (b - rgb[2]);
+			if (nDist < nBestDist)
+			{
+				nBestDist = nDist;
+				nBest = i;
+			}
+		}
+		return nBest;
+	}
+
+	std::string ColorSequence(int nForeground, int nBackground) const
+	{
+		const unsigned char* fg = GetColourRGB(nForeground);
+		const unsigned char* bg = GetColourRGB(nBackground);
+		char sz[64];
+		if (m_bTrueColor)
+			snprintf(sz, sizeof(sz), "\x1b[38;2;%d;%d;%d;48;2;%d;%d;%dm", fg[0], fg[1], fg[2], bg[0], bg[1], bg[2]);
+		else
+			snprintf(sz, sizeof(sz), "\x1b[38;5;%d;48;5;%dm", Xterm256(fg), Xterm256(bg));
+		return sz;
+	}
+
+	void KeyDown(int nKey, double fNow, platformInput& input)
+	{
+		sKeyTimes& k = m_keyTimes[nKey];
+		if (!input.bKeys[nKey])
+		{
+			input.bKeys[nKey] = true;
+			k.fFirst = fNow;
+		}
+		k.fLast = fNow;
+	}
+
+	// Keys, mouse reports and focus reports in what the terminal sent. Stops
+	// at an escape sequence whose final byte hasn't arrived yet and returns
+	// how many bytes were used
+	int Parse(const unsigned char* buf, int n, double fNow, platformInput& input)
+	{
+		int i = 0;
+		while (i < n)
+		{
+			unsigned char c = buf[i++];
+			if (c == 0x03)	// Ctrl+C
+			{
+				if (m_pfnClose)
+					m_pfnClose();
+			}
+			else if (c == 0x1B && i == n)
+				return i - 1;
+			else if (c == 0x1B && (buf[i] == '[' || buf[i] == 'O'))
+			{
+				int nNext = ParseSequence(buf, i + 1, n, fNow, input);
+				if (nNext < 0)
+					return i - 1;
+				i = nNext;
+			}
+			else if (c >= 'a' && c <= 'z')
+				KeyDown(c - 'a' + 'A', fNow, input);
+			else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == ' ')
+				KeyDown(c, fNow, input);
+			else if (c == '\r' || c == '\n')
+				KeyDown(VK_RETURN, fNow, input);
+			else if (c == 0x7F)
+				KeyDown(VK_BACK, fNow, input);
+			else if (c == '\t')
+				KeyDown(VK_TAB, fNow, input);
+			else if (c == 0x1B)
+				KeyDown(VK_ESCAPE, fNow, input);
+		}
+		return n;
+	}
+
+	// The rest of an escape sequence starting at buf[i], just after ESC [ or
+	// ESC O. Returns where the next one starts, or -1 if it doesn't end
+	// before buf[n]
+	int ParseSequence(const unsigned char* buf, int i, int n, double fNow, platformInput& input)
+	{
+		int nStart = i;
+		while (i < n && (buf[i] < 0x40 || buf[i] > 0x7E))
+			i++;
+		if (i >= n)
+			return -1;
+		unsigned char cFinal = buf[i++];
+
+		if (buf[nStart] == '<' && (cFinal == 'M' || cFinal == 'm'))
+		{
+			// Mouse: ESC [ < button ; x ; y, M when pressed or moved, m when released
+			int nums[3] = {}, nField = 0;
+			bool bValid = true;
+			for (int k = nStart + 1; k < i - 1 && bValid; k++)
+			{
+				if (buf[k] >= '0' && buf[k] <= '9' && nums[nField] < 100000)
+					nums[nField] = nums[nField] * 10 + (buf[k] - '0');
+				else if (buf[k] == ';' && nField < 2)
+					nField++;
+				else
+					bValid = false;
+			}
+			if (bValid && nField == 2)
+			{
+				int nButton = nums[0];
+				input.nMouseX = nums[1] - 1;
+				input.nMouseY = nums[2] - 1;
+				static const int buttons[3] = { 0, 2, 1 };	// Left, middle, right to windows.h's order
+				if ((nButton & (32 | 64)) == 0 && (nButton & 3) < 3)
+					input.bMouse[buttons[nButton & 3]] = cFinal == 'M';
+			}
+			return i;
+		}
+
+		switch (cFinal)
+		{
+		case 'A': KeyDown(VK_UP, fNow, input); break;
+		case 'B': KeyDown(VK_DOWN, fNow, input); break;
+		case 'C': KeyDown(VK_RIGHT, fNow, input); break;
+		case 'D': KeyDown(VK_LEFT, fNow, input); break;
+		case 'I': input.bFocused = true; input.bRedraw = true; break;
+		case 'O': input.bFocused = false; break;
+		default: break;
+		}
+		return i;
+	}
+};
+
+// Define our static variables
+constexpr double ansiTerminal::KEY_FIRST_DELAY;
+constexpr double ansiTerminal::KEY_REPEAT_GAP;
+void (*ansiTerminal::m_pfnClose)() = nullptr;
+volatile sig_atomic_t ansiTerminal::m_bResized = 0;
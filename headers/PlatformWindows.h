@@ -0,0 +1,217 @@
+#pragma once
+#pragma comment(lib, "winmm.lib")
+
+#ifndef UNICODE
+#error Please enable UNICODE for your compiler! VS: Project Properties -> General -> \
+Character Set -> Use Unicode.
+#endif
+
+#include <windows.h>
+
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include "Platform.h"
+
+// The Windows console, written a rectangle at a time with WriteConsoleOutput
+class windowsConsole : public consolePlatform
+{
+public:
+	windowsConsole()
+	{
+		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
+		m_hOriginalConsole = m_hConsole;
+	}
+
+	bool Create(int& nWidth, int& nHeight, int nFontWidth, int nFontHeight, void (*pfnClose)()) override
+	{
+		if (m_hConsole == INVALID_HANDLE_VALUE)
+			return Error(L"Bad Handle");
+		if (nWidth <= 0 || nHeight <= 0)
+			return Error(L"Screen Width and Height must be given");
+
+		// Change console visual size to a minimum so ScreenBuffer can shrink
+		// below the actual visual size
+		m_rectWindow = { 0, 0, 1, 1 };
+		SetConsoleWindowInfo(m_hConsole, TRUE, &m_rectWindow);
+
+		// Set the size of the screen buffer
+		COORD coord = { (short)nWidth, (short)nHeight };
+		if (!SetConsoleScreenBufferSize(m_hConsole, coord))
+			Error(L"SetConsoleScreenBufferSize");
+
+		// Assign screen buffer to the console
+		if (!SetConsoleActiveScreenBuffer(m_hConsole))
+			return Error(L"SetConsoleActiveScreenBuffer");
+
+		// Set the font size now that the screen buffer has been assigned to the console
+		CONSOLE_FONT_INFOEX cfi;
+		cfi.cbSize = sizeof(cfi);
+		cfi.nFont = 0;
+		cfi.dwFontSize.X = nFontWidth;
+		cfi.dwFontSize.Y = nFontHeight;
+		cfi.FontFamily = FF_DONTCARE;
+		cfi.FontWeight = FW_NORMAL;
+
+		wcscpy_s(cfi.FaceName, L"Consolas");
+		if (!SetCurrentConsoleFontEx(m_hConsole, false, &cfi))
+			return Error(L"SetCurrentConsoleFontEx");
+
+		// Get screen buffer info and check the maximum allowed window size. Return
+		// error if exceeded, so user knows their dimensions/fontsize are too large
+		CONSOLE_SCREEN_BUFFER_INFO csbi;
+		if (!GetConsoleScreenBufferInfo(m_hConsole, &csbi))
+			return Error(L"GetConsoleScreenBufferInfo");
+		if (nHeight > csbi.dwMaximumWindowSize.Y)
+			return Error(L"Screen Height / Font Height Too Big");
+		if (nWidth > csbi.dwMaximumWindowSize.X)
+			return Error(L"Screen Width / Font Width Too Big");
+
+		// Set Physical Console Window Size
+		m_rectWindow = { 0, 0, (short)nWidth - 1, (short)nHeight - 1 };
+		if (!SetConsoleWindowInfo(m_hConsole, TRUE, &m_rectWindow))
+			return Error(L"SetConsoleWindowInfo");
+
+		// Set flags to allow mouse input
+		if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT))
+			return Error(L"SetConsoleMode");
+
+		m_pfnClose = pfnClose;
+		m_bRestored = false;
+		SetConsoleCtrlHandler((PHANDLER_ROUTINE)CloseHandler, TRUE);
+		return true;
+	}
+
+	void Restore() override
+	{
+		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
+
+		// Let CloseHandler return, now that the game has cleaned up
+		std::lock_guard<std::mutex> lock(m_muxRestored);
+		m_bRestored = true;
+		m_cvRestored.notify_all();
+	}
+
+	void ReadInput(platformInput& input) override
+	{
+		for (int i = 0; i < 256; i++)
+			input.bKeys[i] = (GetAsyncKeyState(i) & 0x8000) != 0;
+
+		// Handle Mouse Input - Check for window events
+		INPUT_RECORD inBuf[32];
+		DWORD events = 0;
+		GetNumberOfConsoleInputEvents(m_hConsoleIn, &events);
+		if (events > 32)
+			events = 32;
+		if (events > 0)
+			ReadConsoleInput(m_hConsoleIn, inBuf, events, &events);
+
+		// Handle events - we only care about mouse clicks and movement
+		// for now
+		for (DWORD i = 0; i < events; i++)
+		{
+			switch (inBuf[i].EventType)
+			{
+			case FOCUS_EVENT:
+			{
+				input.bFocused = inBuf[i].Event.FocusEvent.bSetFocus != 0;
+				// The console may have been drawn over while away
+				input.bRedraw = true;
+			}
+			break;
+
+			case MOUSE_EVENT:
+			{
+				switch (inBuf[i].Event.MouseEvent.dwEventFlags)
+				{
+				case MOUSE_MOVED:
+				{
+					input.nMouseX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
+					input.nMouseY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
+				}
+				break;
+
+				case 0:
+				{
+					for (int m = 0; m < 5; m++)
+						input.bMouse[m] = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) > 0;
+
+				}
+				break;
+
+				default:
+					break;
+				}
+			}
+			break;
+
+			default:
+				break;
+				// We don't care just at the moment
+			}
+		}
+	}
+
+	// The runs are covered with a few rectangles, one WriteConsoleOutput each
+	void Present(const CHAR_INFO* pCells, int nWidth, int nHeight, const std::vector<dirtyRun>& runs) override
+	{
+		frameDelta::Rects(runs, m_vecDirtyRects);
+		for (auto& rc : m_vecDirtyRects)
+		{
+			SMALL_RECT rectWrite = { (short)rc.nLeft, (short)rc.nTop, (short)rc.nRight, (short)rc.nBottom };
+			WriteConsoleOutput(m_hConsole, pCells, { (short)nWidth, (short)nHeight },
+				{ (short)rc.nLeft, (short)rc.nTop }, &rectWrite);
+		}
+	}
+
+	void SetTitle(const std::wstring& title) override
+	{
+		SetConsoleTitle(title.c_str());
+	}
+
+private:
+	HANDLE m_hOriginalConsole;
+	HANDLE m_hConsole;
+	HANDLE m_hConsoleIn;
+	SMALL_RECT m_rectWindow;
+	std::vector<dirtyRect> m_vecDirtyRects;
+
+	bool Error(const wchar_t* msg)
+	{
+		wchar_t buf[256];
+		FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, 256, NULL);
+		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
+		wprintf(L"ERROR: %s\n\t%s\n", msg, buf);
+		return false;
+	}
+
+	static BOOL CloseHandler(DWORD evt)
+	{
+		// Note this gets called in a seperate OS thread, so it must
+		// only exit when the game has finished cleaning up, or else
+		// the process will be killed before OnUserDestroy() has finished
+		if (evt == CTRL_CLOSE_EVENT)
+		{
+			m_pfnClose();
+
+			// Wait for the game to give the console back
+			std::unique_lock<std::mutex> ul(m_muxRestored);
+			m_cvRestored.wait(ul, []() { return m_bRestored; });
+		}
+		return true;
+	}
+
+	// These need to be static because CloseHandler is called by the OS, on a
+	// thread of its own
+	static void (*m_pfnClose)();
+	static bool m_bRestored;
+	static std::condition_variable m_cvRestored;
+	static std::mutex m_muxRestored;
+};
+
+// Define our static variables
+void (*windowsConsole::m_pfnClose)() = nullptr;
+bool windowsConsole::m_bRestored = false;
+std::condition_variable windowsConsole::m_cvRestored;
+std::mutex windowsConsole::m_muxRestored;
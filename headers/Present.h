@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// Cells x1 to x2 of row y
+struct dirtyRun
+{
+	int y, x1, x2;
+};
+
+// Cells nLeft to nRight of rows nTop to nBottom, all inclusive like SMALL_RECT
+struct dirtyRect
+{
+	int nLeft, nTop, nRight, nBottom;
+};
+
+// Keeps a copy of the last frame presented, so the next one can be presented
+// by writing only the cells that changed. Frames are nWidth x nHeight bytes,
+// one a cell, row by row
+class frameDelta
+{
+public:
+	// Changed cells up to RUN_GAP apart go in one run: skipping the unchanged
+	// cells between them costs about as much as rewriting them
+	static const int RUN_GAP = 8;
+
+	// Forget the last frame, so all of the next one is presented
+	void Invalidate()
+	{
+		m_bValid = false;
+	}
+
+	// Compare pFrame with the last frame, filling runs with the stretches of
+	// each row that changed, top to bottom and left to right, and keep it as
+	// the last frame. Everything is a change after Invalidate or a resize.
+	// Rows are compared whole first, since most are unchanged in a mostly still
+	// scene, and changed rows are searched 8 cells at a time
+	void Diff(const uint8_t* pFrame, int nWidth, int nHeight, std::vector<dirtyRun>& runs)
+	{
+		runs.clear();
+		if (!m_bValid || nWidth != m_nWidth || nHeight != m_nHeight)
+		{
+			m_prev.assign(pFrame, pFrame + (size_t)nWidth * nHeight);
+			m_nWidth = nWidth;
+			m_nHeight = nHeight;
+			m_bValid = true;
+			for (int y = 0; y < nHeight; y++)
+				runs.push_back({ y, 0, nWidth - 1 });
+			return;
+		}
+
+		for (int y = 0; y < nHeight; y++)
+		{
+			const uint8_t* pNew = pFrame + (size_t)y * nWidth;
+			uint8_t* pOld = &m_prev[(size_t)y * nWidth];
+			if (memcmp(pNew, pOld, nWidth) == 0)
+				continue;
+
+			int x = 0;
+			while (true)
+			{
+				while (x + 8 <= nWidth && Load8(pNew + x) == Load8(pOld + x))
+					x += 8;
+				while (x < nWidth && pNew[x] == pOld[x])
+					x++;
+				if (x >= nWidth)
+					break;
+
+				// Extend the run until RUN_GAP cells in a row are unchanged
+				int x1 = x, nLast = x;
+				for (x++; x < nWidth && x - nLast <= RUN_GAP; x++)
+					if (pNew[x] != pOld[x])
+						nLast = x;
+				runs.push_back({ y, x1, nLast });
+				x = nLast + 1;
+			}
+			memcpy(pOld, pNew, nWidth);
+		}
+	}
+
+	// Cover the runs with rectangles, for console APIs that write a rectangle
+	// at a time. Each row's runs become one span, and spans of neighbouring
+	// rows are joined while the rectangle has no more than twice as many cells
+	// as the spans in it, which keeps the number of writes small without
+	// rewriting much that hasn't changed
+	static void Rects(const std::vector<dirtyRun>& runs, std::vector<dirtyRect>& rects)
+	{
+		rects.clear();
+		dirtyRect rc = { 0, 0, 0, 0 };
+		long nSpanCells = 0;
+		size_t i = 0;
+		while (i < runs.size())
+		{
+			// This row's span
+			int y = runs[i].y, x1 = runs[i].x1, x2 = runs[i].x2;
+			for (i++; i < runs.size() && runs[i].y == y; i++)
+				x2 = runs[i].x2;
+			long nCells = x2 - x1 + 1;
+
+			if (!rects.empty() && y == rc.nBottom + 1)
+			{
+				int nLeft = x1 < rc.nLeft ? x1 : rc.nLeft;
+				int nRight = x2 > rc.nRight ? x2 : rc.nRight;
+				long nArea = (long)(nRight - nLeft + 1) * (y - rc.nTop + 1);
+				if (nArea <= 2 * (nSpanCells + nCells))
+				{
+					rc = { nLeft, rc.nTop, nRight, y };
+					rects.back() = rc;
+					nSpanCells += nCells;
+					continue;
+				}
+			}
+			rc = { x1, y, x2, y };
+			rects.push_back(rc);
+			nSpanCells = nCells;
+		}
+	}
+
+private:
+	std::vector<uint8_t> m_prev;
+	int m_nWidth = 0, m_nHeight = 0;
+	bool m_bValid = false;
+
+	static uint64_t Load8(const uint8_t* p)
+	{
+		uint64_t n;
+		memcpy(&n, p, sizeof(n));
+		return n;
+	}
+};
@@ -0,0 +1,438 @@
+#pragma once
+
+#include "Simd.h"
+
+// Triangle rasterizers. They draw into plain arrays of cells rather than the
+// console, so tools can run and compare them without one
+
+// Cells nLeft to nRight - 1 of rows nTop to nBottom - 1. The rasterizers draw
+// only inside one, the whole screen or a tile of it
+struct rasterRect
+{
+	int nLeft, nTop, nRight, nBottom;
+};
+
+// Walk the rows of a triangle with corners on whole cells, calling
+// span(sx, ex, y) for the cells sx to ex of each row that is inside rcClip.
+// Both ends of every edge are included, so neighbouring triangles overlap
+// along the edges they share. This is the rasterizer behind
+// hamroGraphics::FillTriangle
+// https://www.avrfreaks.net/sites/default/files/triangles.c
+template<class F>
+inline void Raster_ScanTriangle(const rasterRect& rcClip, int x1, int y1, int x2, int y2, int x3, int y3, F span)
+{
+	auto SWAP = [](int& x, int& y) { int t = x; x = y; y = t; };
+	// Spans are clamped to rcClip, so triangles reaching past the screen edges
+	// can be drawn without clipping them first. The walk itself doesn't depend
+	// on rcClip, so a triangle drawn a tile at a time covers the same cells
+	auto drawline = [&](int sx, int ex, int ny)
+	{
+		if (ny < rcClip.nTop || ny >= rcClip.nBottom) return;
+		if (sx < rcClip.nLeft) sx = rcClip.nLeft;
+		if (ex >= rcClip.nRight) ex = rcClip.nRight - 1;
+		if (sx <= ex) span(sx, ex, ny);
+	};
+
+	int t1x, t2x, y, minx, maxx, t1xp, t2xp;
+	bool changed1 = false;
+	bool changed2 = false;
+	int signx1, signx2, dx1, dy1, dx2, dy2;
+	int e1, e2;
+	// Sort vertices
+	if (y1 > y2) { SWAP(y1, y2); SWAP(x1, x2); }
+	if (y1 > y3) { SWAP(y1, y3); SWAP(x1, x3); }
+	if (y2 > y3) { SWAP(y2, y3); SWAP(x2, x3); }
+
+	t1x = t2x = x1; y = y1;   // Starting points
+	dx1 = (int)(x2 - x1); if (dx1 < 0) { dx1 = -dx1; signx1 = -1; }
+	else signx1 = 1;
+	dy1 = (int)(y2 - y1);
+
+	dx2 = (int)(x3 - x1); if (dx2 < 0) { dx2 = -dx2; signx2 = -1; }
+	else signx2 = 1;
+	dy2 = (int)(y3 - y1);
+
+	if (dy1 > dx1) {   // swap values
+		SWAP(dx1, dy1);
+		changed1 = true;
+	}
+	if (dy2 > dx2) {   // swap values
+		SWAP(dy2, dx2);
+		changed2 = true;
+	}
+
+	e2 = (int)(dx2 >> 1);
+	// Flat top, just process the second half
+	if (y1 == y2) goto next;
+	e1 = (int)(dx1 >> 1);
+
+	for (int i = 0; i < dx1;) {
+		t1xp = 0; t2xp = 0;
+		if (t1x < t2x) { minx = t1x; maxx = t2x; }
+		else { minx = t2x; maxx = t1x; }
+		// process first line until y value is about to change
+		while (i < dx1) {
+			i++;
+			e1 += dy1;
+			while (e1 >= dx1) {
+				e1 -= dx1;
+				if (changed1) t1xp = signx1;//t1x += signx1;
+				else          goto next1;
+			}
+			if (changed1) break;
+			else t1x += signx1;
+		}
+		// Move line
+	next1:
+		// process second line until y value is about to change
+		while (1) {
+			e2 += dy2;
+			while (e2 >= dx2) {
+				e2 -= dx2;
+				if (changed2) t2xp = signx2;//t2x += signx2;
+				else          goto next2;
+			}
+			if (changed2)     break;
+			else              t2x += signx2;
+		}
+	next2:
+		if (minx > t1x) minx = t1x;
+		if (minx > t2x) minx = t2x;
+		if (maxx < t1x) maxx = t1x;
+		if (maxx < t2x) maxx = t2x;
+		drawline(minx, maxx, y);    // Draw line from min to max points found on the y
+									 // Now increase y
+		if (!changed1) t1x += signx1;
+		t1x += t1xp;
+		if (!changed2) t2x += signx2;
+		t2x += t2xp;
+		y += 1;
+		if (y == y2) break;
+		if (y >= rcClip.nBottom) return;	// The rest is below rcClip
+
+	}
+next:
+	// Second half
+	dx1 = (int)(x3 - x2); if (dx1 < 0) { dx1 = -dx1; signx1 = -1; }
+	else signx1 = 1;
+	dy1 = (int)(y3 - y2);
+	t1x = x2;
+
+	if (dy1 > dx1) {   // swap values
+		SWAP(dy1, dx1);
+		changed1 = true;
+	}
+	else changed1 = false;
+
+	e1 = (int)(dx1 >> 1);
+
+	for (int i = 0; i <= dx1; i++) {
+		t1xp = 0; t2xp = 0;
+		if (t1x < t2x) { minx = t1x; maxx = t2x; }
+		else { minx = t2x; maxx = t1x; }
+		// process first line until y value is about to change
+		while (i < dx1) {
+			e1 += dy1;
+			while (e1 >= dx1) {
+				e1 -= dx1;
+				if (changed1) { t1xp = signx1; break; }//t1x += signx1;
+				else          goto next3;
+			}
+			if (changed1) break;
+			else   	   	  t1x += signx1;
+			if (i < dx1) i++;
+		}
+	next3:
+		// process second line until y value is about to change
+		while (t2x != x3) {
+			e2 += dy2;
+			while (e2 >= dx2) {
+				e2 -= dx2;
+				if (changed2) t2xp = signx2;
+				else          goto next4;
+			}
+			if (changed2)     break;
+			else              t2x += signx2;
+		}
+	next4:
+
+		if (minx > t1x) minx = t1x;
+		if (minx > t2x) minx = t2x;
+		if (maxx < t1x) maxx = t1x;
+		if (maxx < t2x) maxx = t2x;
+		drawline(minx, maxx, y);
+		if (!changed1) t1x += signx1;
+		t1x += t1xp;
+		if (!changed2) t2x += signx2;
+		t2x += t2xp;
+		y += 1;
+		if (y > y3 || y >= rcClip.nBottom) return;
+	}
+}
+
+// Same, drawing anywhere on an nWidth by nHeight screen
+template<class F>
+inline void Raster_ScanTriangle(int nWidth, int nHeight, int x1, int y1, int x2, int y2, int x3, int y3, F span)
+{
+	Raster_ScanTriangle(rasterRect{ 0, 0, nWidth, nHeight }, x1, y1, x2, y2, x3, y3, span);
+}
+
+// Cells and depth buffer drawn into by Raster_HalfSpaceTriangle. Both are
+// nWidth * nHeight entries, row by row. Depth is 1 / w, so larger is nearer
+// and 0 means nothing has been drawn
+template<class Cell>
+struct rasterTarget
+{
+	Cell* pCells;
+	float* pDepth;
+	int nWidth, nHeight;
+};
+
+// Corners are snapped to 1/16 of a cell, and the screen is covered in blocks of
+// RASTER_BLOCK x RASTER_BLOCK cells
+const int RASTER_SUBPIXEL_BITS = 4;
+const int RASTER_BLOCK = 8;
+
+// Draw a depth tested triangle with corners anywhere in the guard band (see
+// hamroEngine3D::GUARD_BAND), given in cells with fractions, and z1 to z3 the
+// 1 / w at each corner. A cell is covered when its centre is inside all three
+// edge functions, evaluated in fixed point. Cells on an edge go to the
+// triangle the edge is a top or left edge of, so triangles sharing an edge
+// cover each cell along it exactly once.
+// The triangle's bounding box is walked in blocks. Blocks wholly outside an
+// edge are skipped, blocks wholly inside all three skip the edge tests, and
+// the rest are tested a row of 8 cells at a time, 4 at once with SSE.
+// Edge values are worked out 64 bit at each block's corners, and only stepped
+// across a block 32 bit, so any screen size and guard band fit.
+// Only cells inside rcClip are read or written, so tiles can be drawn on
+// different threads. Blocks that stick out of it take the slower one cell at
+// a time path, which tiles lined up with the blocks never need
+template<class Cell>
+inline void Raster_HalfSpaceTriangle(const rasterTarget<Cell>& target, const rasterRect& rcClip, float fx1, float fy1, float z1, float fx2, float fy2, float z2, float fx3, float fy3, float z3, Cell value)
+{
+	const float fOne = (float)(1 << RASTER_SUBPIXEL_BITS);
+	const int nHalf = 1 << (RASTER_SUBPIXEL_BITS - 1);	// Centre of a cell
+	int x1 = (int)floorf(fx1 * fOne + 0.5f), y1 = (int)floorf(fy1 * fOne + 0.5f);
+	int x2 = (int)floorf(fx2 * fOne + 0.5f), y2 = (int)floorf(fy2 * fOne + 0.5f);
+	int x3 = (int)floorf(fx3 * fOne + 0.5f), y3 = (int)floorf(fy3 * fOne + 0.5f);
+
+	// Make the winding the one where the edge functions are positive inside
+	int64_t nArea = (int64_t)(x2 - x1) * (y3 - y1) - (int64_t)(y2 - y1) * (x3 - x1);
+	if (nArea == 0)
+		return;
+	if (nArea < 0)
+	{
+		int t;
+		t = x2; x2 = x3; x3 = t;
+		t = y2; y2 = y3; y3 = t;
+		float f = z2; z2 = z3; z3 = f;
+	}
+
+	// Bounding box in cells, clamped to rcClip. Shifting right rounds down,
+	// negative values included
+	int nMinFX = x1 < x2 ? x1 : x2; if (x3 < nMinFX) nMinFX = x3;
+	int nMaxFX = x1 > x2 ? x1 : x2; if (x3 > nMaxFX) nMaxFX = x3;
+	int nMinFY = y1 < y2 ? y1 : y2; if (y3 < nMinFY) nMinFY = y3;
+	int nMaxFY = y1 > y2 ? y1 : y2; if (y3 > nMaxFY) nMaxFY = y3;
+	int nMinX = nMinFX >> RASTER_SUBPIXEL_BITS, nMaxX = nMaxFX >> RASTER_SUBPIXEL_BITS;
+	int nMinY = nMinFY >> RASTER_SUBPIXEL_BITS, nMaxY = nMaxFY >> RASTER_SUBPIXEL_BITS;
+	if (nMinX < rcClip.nLeft) nMinX = rcClip.nLeft;
+	if (nMinY < rcClip.nTop) nMinY = rcClip.nTop;
+	if (nMaxX >= rcClip.nRight) nMaxX = rcClip.nRight - 1;
+	if (nMaxY >= rcClip.nBottom) nMaxY = rcClip.nBottom - 1;
+	if (nMinX > nMaxX || nMinY > nMaxY)
+		return;
+
+	// Edge a -> b is E(x, y) = dx * (x - ax) + dy * (y - ay), so stepping one cell
+	// right adds nStepX and one cell down adds nStepY. Edges that aren't top or
+	// left edges are biased by -1, so a centre exactly on them is left out.
+	// The function is linear, so over a block it is smallest at the corner
+	// nLowest from the first cell and largest at nHighest, picked by the signs
+	// of the steps
+	struct sEdge { int nStepX, nStepY; int64_t nOrigin; int nLowest, nHighest; };
+	auto edge = [&](int ax, int ay, int bx, int by)
+	{
+		int dx = ay - by, dy = bx - ax;
+		bool bTopLeft = dx > 0 || (dx == 0 && dy > 0);
+		sEdge e;
+		e.nStepX = dx * (1 << RASTER_SUBPIXEL_BITS);
+		e.nStepY = dy * (1 << RASTER_SUBPIXEL_BITS);
+		// Value at the centre of cell (0, 0)
+		e.nOrigin = (int64_t)dx * (nHalf - ax) + (int64_t)dy * (nHalf - ay) - (bTopLeft ? 0 : 1);
+		int nAcross = e.nStepX * (RASTER_BLOCK - 1), nDown = e.nStepY * (RASTER_BLOCK - 1);
+		e.nLowest = (nAcross < 0 ? nAcross : 0) + (nDown < 0 ? nDown : 0);
+		e.nHighest = (nAcross > 0 ? nAcross : 0) + (nDown > 0 ? nDown : 0);
+		return e;
+	};
+	sEdge edges[3] = { edge(x1, y1, x2, y2), edge(x2, y2, x3, y3), edge(x3, y3, x1, y1) };
+
+	// 1 / w as a plane across the screen, through the snapped corners
+	float fDet = (float)nArea;
+	if (fDet < 0.0f) fDet = -fDet;
+	float fX1 = (float)x1 / fOne, fY1 = (float)y1 / fOne;
+	float fX2 = (float)x2 / fOne, fY2 = (float)y2 / fOne;
+	float fX3 = (float)x3 / fOne, fY3 = (float)y3 / fOne;
+	float fInvDet = fOne * fOne / fDet;
+	float fDzDx = ((z2 - z1) * (fY3 - fY1) - (z3 - z1) * (fY2 - fY1)) * fInvDet;
+	float fDzDy = ((z3 - z1) * (fX2 - fX1) - (z2 - z1) * (fX3 - fX1)) * fInvDet;
+	float fZ0 = z1 + fDzDx * (0.5f - fX1) + fDzDy * (0.5f - fY1);	// At the centre of cell (0, 0)
+	float fMinZ = z1 < z2 ? z1 : z2; if (z3 < fMinZ) fMinZ = z3;
+	float fMaxZ = z1 > z2 ? z1 : z2; if (z3 > fMaxZ) fMaxZ = z3;
+
+	// Depth test and draw the cells from x to x + n - 1 of row y that are inside
+	// (all of them if bFull), one at a time. pE holds the edge values at x. Used
+	// where a whole block doesn't fit in rcClip, and when there is no SSE
+	auto drawCells = [&](int x, int y, int n, const int* pE, bool bFull)
+	{
+		float* pDepth = &target.pDepth[y * target.nWidth];
+		Cell* pCells = &target.pCells[y * target.nWidth];
+		float z = fZ0 + fDzDx * (float)x + fDzDy * (float)y;
+		int e0 = pE[0], e1 = pE[1], e2 = pE[2];
+		for (int i = x; i < x + n; i++)
+		{
+			if (bFull || (e0 | e1 | e2) >= 0)
+			{
+				float zCell = z < fMinZ ? fMinZ : (z > fMaxZ ? fMaxZ : z);
+				if (zCell > pDepth[i])
+				{
+					pDepth[i] = zCell;
+					pCells[i] = value;
+				}
+			}
+			z += fDzDx;
+			e0 += edges[0].nStepX;
+			e1 += edges[1].nStepX;
+			e2 += edges[2].nStepX;
+		}
+	};
+
+#if HAMRO_SIMD
+	const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+	__m128i vStepX[3], vStepY[3], vLaneE[3];
+	for (int k = 0; k < 3; k++)
+	{
+		vStepX[k] = _mm_set1_epi32(edges[k].nStepX * 4);
+		vStepY[k] = _mm_set1_epi32(edges[k].nStepY);
+		// Offsets of the four lanes from the first
+		int s = edges[k].nStepX;
+		vLaneE[k] = _mm_set_epi32(3 * s, 2 * s, s, 0);
+	}
+	const __m128 vLaneZ = _mm_set_ps(3.0f * fDzDx, 2.0f * fDzDx, fDzDx, 0.0f);
+	const __m128 vStepZ = _mm_set1_ps(4.0f * fDzDx);
+	const __m128 vStepRowZ = _mm_set1_ps(fDzDy);
+	const __m128 vMinZ = _mm_set1_ps(fMinZ), vMaxZ = _mm_set1_ps(fMaxZ);
+#endif
+
+	for (int by = nMinY & ~(RASTER_BLOCK - 1); by <= nMaxY; by += RASTER_BLOCK)
+	{
+		for (int bx = nMinX & ~(RASTER_BLOCK - 1); bx <= nMaxX; bx += RASTER_BLOCK)
+		{
+			// Edge values at the block's first cell, and the least and most they
+			// reach over it. An edge the whole block is inside of only has to
+			// stay positive across it, so it is lowered to 0 at its lowest
+			// corner, which keeps it 32 bit however far away the edge is. One
+			// that crosses the block is small already
+			int e[3];
+			bool bFull = true;
+			bool bOutside = false;
+			for (int k = 0; k < 3; k++)
+			{
+				const sEdge& ed = edges[k];
+				int64_t e00 = ed.nOrigin + (int64_t)ed.nStepX * bx + (int64_t)ed.nStepY * by;
+				int64_t nLowest = e00 + ed.nLowest;
+				bOutside |= e00 + ed.nHighest < 0;
+				bFull &= nLowest >= 0;
+				e[k] = (int)(nLowest >= 0 ? -(int64_t)ed.nLowest : e00);
+			}
+			if (bOutside)
+				continue;
+
+			int nFromX = bx < nMinX ? nMinX : bx;
+			int nToX = bx + RASTER_BLOCK - 1 > nMaxX ? nMaxX : bx + RASTER_BLOCK - 1;
+			int nFromY = by < nMinY ? nMinY : by;
+			int nToY = by + RASTER_BLOCK - 1 > nMaxY ? nMaxY : by + RASTER_BLOCK - 1;
+			for (int k = 0; k < 3; k++)
+				e[k] += edges[k].nStepY * (nFromY - by);
+
+#if HAMRO_SIMD
+			if (bx >= rcClip.nLeft && bx + RASTER_BLOCK <= rcClip.nRight)
+			{
+				// Lanes of the block's columns that are inside the bounding box
+				__m128i vCol0 = _mm_add_epi32(_mm_set1_epi32(bx), lane);
+				__m128i vCol1 = _mm_add_epi32(vCol0, _mm_set1_epi32(4));
+				__m128i vFirst = _mm_set1_epi32(nFromX - 1), vLast = _mm_set1_epi32(nToX + 1);
+				__m128i vBox0 = _mm_and_si128(_mm_cmpgt_epi32(vCol0, vFirst), _mm_cmplt_epi32(vCol0, vLast));
+				__m128i vBox1 = _mm_and_si128(_mm_cmpgt_epi32(vCol1, vFirst), _mm_cmplt_epi32(vCol1, vLast));
+
+				// Edge values and depth in each lane, stepped down a row at a time
+				__m128i vA0 = _mm_add_epi32(_mm_set1_epi32(e[0]), vLaneE[0]), vA1 = _mm_add_epi32(vA0, vStepX[0]);
+				__m128i vB0 = _mm_add_epi32(_mm_set1_epi32(e[1]), vLaneE[1]), vB1 = _mm_add_epi32(vB0, vStepX[1]);
+				__m128i vC0 = _mm_add_epi32(_mm_set1_epi32(e[2]), vLaneE[2]), vC1 = _mm_add_epi32(vC0, vStepX[2]);
+				__m128 vZ0 = _mm_add_ps(_mm_set1_ps(fZ0 + fDzDx * (float)bx + fDzDy * (float)nFromY), vLaneZ);
+				__m128 vZ1 = _mm_add_ps(vZ0, vStepZ);
+
+				float* pDepth = &target.pDepth[nFromY * target.nWidth + bx];
+				Cell* pCells = &target.pCells[nFromY * target.nWidth + bx];
+				for (int y = nFromY; y <= nToY; y++)
+				{
+					// A cell is inside when no edge value has its sign bit set
+					__m128i vIn0 = vBox0, vIn1 = vBox1;
+					if (!bFull)
+					{
+						vIn0 = _mm_andnot_si128(_mm_srai_epi32(_mm_or_si128(_mm_or_si128(vA0, vB0), vC0), 31), vIn0);
+						vIn1 = _mm_andnot_si128(_mm_srai_epi32(_mm_or_si128(_mm_or_si128(vA1, vB1), vC1), 31), vIn1);
+					}
+
+					// Depth test, then keep the nearer depth in every lane
+					__m128 vCellZ0 = _mm_min_ps(_mm_max_ps(vZ0, vMinZ), vMaxZ);
+					__m128 vCellZ1 = _mm_min_ps(_mm_max_ps(vZ1, vMinZ), vMaxZ);
+					__m128 vOld0 = _mm_loadu_ps(pDepth), vOld1 = _mm_loadu_ps(pDepth + 4);
+					__m128 vPass0 = _mm_and_ps(_mm_castsi128_ps(vIn0), _mm_cmpgt_ps(vCellZ0, vOld0));
+					__m128 vPass1 = _mm_and_ps(_mm_castsi128_ps(vIn1), _mm_cmpgt_ps(vCellZ1, vOld1));
+					int nMask = _mm_movemask_ps(vPass0) | (_mm_movemask_ps(vPass1) << 4);
+					if (nMask)
+					{
+						_mm_storeu_ps(pDepth, _mm_or_ps(_mm_and_ps(vPass0, vCellZ0), _mm_andnot_ps(vPass0, vOld0)));
+						_mm_storeu_ps(pDepth + 4, _mm_or_ps(_mm_and_ps(vPass1, vCellZ1), _mm_andnot_ps(vPass1, vOld1)));
+						if (nMask == (1 << RASTER_BLOCK) - 1)
+						{
+							for (int i = 0; i < RASTER_BLOCK; i++)
+								pCells[i] = value;
+						}
+						else
+						{
+							for (int i = 0; i < RASTER_BLOCK; i++)
+								if (nMask & (1 << i))
+									pCells[i] = value;
+						}
+					}
+
+					vA0 = _mm_add_epi32(vA0, vStepY[0]); vA1 = _mm_add_epi32(vA1, vStepY[0]);
+					vB0 = _mm_add_epi32(vB0, vStepY[1]); vB1 = _mm_add_epi32(vB1, vStepY[1]);
+					vC0 = _mm_add_epi32(vC0, vStepY[2]); vC1 = _mm_add_epi32(vC1, vStepY[2]);
+					vZ0 = _mm_add_ps(vZ0, vStepRowZ);
+					vZ1 = _mm_add_ps(vZ1, vStepRowZ);
+					pDepth += target.nWidth;
+					pCells += target.nWidth;
+				}
+				continue;
+			}
+#endif
+			for (int k = 0; k < 3; k++)
+				e[k] += edges[k].nStepX * (nFromX - bx);
+			for (int y = nFromY; y <= nToY; y++)
+			{
+				drawCells(nFromX, y, nToX - nFromX + 1, e, bFull);
+				for (int k = 0; k < 3; k++)
+					e[k] += edges[k].nStepY;
+			}
+		}
+	}
+}
+
+// Same, drawing anywhere on the target
+template<class Cell>
+inline void Raster_HalfSpaceTriangle(const rasterTarget<Cell>& target, float fx1, float fy1, float z1, float fx2, float fy2, float z2, float fx3, float fy3, float z3, Cell value)
+{
+	Raster_HalfSpaceTriangle(target, rasterRect{ 0, 0, target.nWidth, target.nHeight }, fx1, fy1, z1, fx2, fy2, z2, fx3, fy3, z3, value);
+}
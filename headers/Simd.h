@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Mesh.h"
+
+// SSE versions of the matrix helpers are used in x64 builds, where SSE2 is
+// always there and new/malloc always return 16 byte aligned memory. Define
+// HAMRO_NO_SIMD to build the plain C++ versions instead. Both add and multiply
+// in the same order, so they give the same results bit for bit.
+// The 3 component Vector helpers stay plain C++: they are called on vectors
+// whose fields were just written one at a time, and reloading those as a whole
+// register stalls for longer than the SSE arithmetic saves
+#if !defined(HAMRO_NO_SIMD) && (defined(_M_X64) || defined(__x86_64__))
+#define HAMRO_SIMD 1
+#include <emmintrin.h>
+#else
+#define HAMRO_SIMD 0
+#endif
+
+#if HAMRO_SIMD
+namespace simd
+{
+	inline __m128 Load(const vec3d& v) { return _mm_load_ps(&v.x); }
+	inline __m128 LoadRow(const mat4x4& m, int r) { return _mm_load_ps(m.m[r]); }
+
+	inline vec3d Store(__m128 r)
+	{
+		vec3d v;
+		_mm_store_ps(&v.x, r);
+		return v;
+	}
+
+	template<int i>
+	inline __m128 Splat(__m128 r) { return _mm_shuffle_ps(r, r, _MM_SHUFFLE(i, i, i, i)); }
+
+	// x * row 0 + y * row 1 + z * row 2
+	inline __m128 MultiplyRows3(__m128 v, const mat4x4& m)
+	{
+		__m128 r = _mm_mul_ps(Splat<0>(v), LoadRow(m, 0));
+		r = _mm_add_ps(r, _mm_mul_ps(Splat<1>(v), LoadRow(m, 1)));
+		return _mm_add_ps(r, _mm_mul_ps(Splat<2>(v), LoadRow(m, 2)));
+	}
+
+	// x * row 0 + y * row 1 + z * row 2 + w * row 3
+	inline __m128 MultiplyRows(__m128 v, const mat4x4& m)
+	{
+		return _mm_add_ps(MultiplyRows3(v, m), _mm_mul_ps(Splat<3>(v), LoadRow(m, 3)));
+	}
+}
+#endif
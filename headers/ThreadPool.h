@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of worker threads that run queued tasks
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned nThreads = 0)
+	{
+		if (nThreads == 0)
+			nThreads = std::thread::hardware_concurrency();
+		if (nThreads == 0)
+			nThreads = 1;
+
+		for (unsigned i = 0; i < nThreads; i++)
+			m_workers.emplace_back(&ThreadPool::WorkerThread, this);
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mux);
+			m_bStop = true;
+		}
+		m_cvTask.notify_all();
+		for (auto& t : m_workers)
+			t.join();
+	}
+
+	unsigned Size() const { return (unsigned)m_workers.size(); }
+
+	// Queue a task, the returned future gives its result once it has run
+	template<class F>
+	auto Submit(F task) -> std::future<decltype(task())>
+	{
+		auto job = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+		auto result = job->get_future();
+		{
+			std::unique_lock<std::mutex> lock(m_mux);
+			m_tasks.push([job]() { (*job)(); });
+		}
+		m_cvTask.notify_one();
+		return result;
+	}
+
+	// Run fn(0) .. fn(n - 1) spread over the workers and return when all are done.
+	// The calling thread takes part too, so this never waits on a worker that is
+	// busy (or itself blocked in ParallelFor) and is safe to call from a task.
+	// nMaxThreads limits how many threads, the caller included, work on it (0
+	// for no limit)
+	void ParallelFor(size_t n, const std::function<void(size_t)>& fn, unsigned nMaxThreads = 0)
+	{
+		if (n == 0)
+			return;
+
+		struct sJob
+		{
+			std::function<void(size_t)> fn;
+			size_t n;
+			std::atomic<size_t> next{ 0 };
+			std::atomic<size_t> done{ 0 };
+			std::mutex mux;
+			std::condition_variable cvDone;
+
+			void Run()
+			{
+				size_t i;
+				while ((i = next++) < n)
+				{
+					fn(i);
+					if (++done == n)
+					{
+						std::unique_lock<std::mutex> lock(mux);
+						cvDone.notify_all();
+					}
+				}
+			}
+		};
+
+		auto job = std::make_shared<sJob>();
+		job->fn = fn;
+		job->n = n;
+
+		size_t nHelpers = n - 1 < m_workers.size() ? n - 1 : m_workers.size();
+		if (nMaxThreads > 0 && nHelpers > nMaxThreads - 1)
+			nHelpers = nMaxThreads - 1;
+		if (nHelpers > 0)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mux);
+				for (size_t i = 0; i < nHelpers; i++)
+					m_tasks.push([job]() { job->Run(); });
+			}
+			m_cvTask.notify_all();
+		}
+
+		job->Run();
+
+		std::unique_lock<std::mutex> lock(job->mux);
+		job->cvDone.wait(lock, [&]() { return job->done == n; });
+	}
+
+private:
+	void WorkerThread()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mux);
+				m_cvTask.wait(lock, [this]() { return m_bStop || !m_tasks.empty(); });
+				if (m_bStop && m_tasks.empty())
+					return;
+				task = std::move(m_tasks.front());
+				m_tasks.pop();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::queue<std::function<void()>> m_tasks;
+	std::mutex m_mux;
+	std::condition_variable m_cvTask;
+	bool m_bStop = false;
+};
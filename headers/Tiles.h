@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Mesh.h"
+#include "Raster.h"
+
+#include <vector>
+
+// The screen cut into tiles, each with a list (bin) of the projected triangles
+// that may cover cells in it, in the order they were added. Tiles don't share
+// cells, so each can be rasterized on its own thread without locks, and
+// drawing a tile's bin in order keeps the draw order within it.
+// Bins keep their memory from frame to frame. They point at the triangles
+// rather than copying them, so the triangles must stay put until drawn
+struct tileBins
+{
+	// Tiles are TILE_WIDTH x TILE_HEIGHT cells. The width is a whole number of
+	// rasterizer blocks, so Raster_HalfSpaceTriangle never has a block sticking
+	// out of a tile
+	static const int TILE_WIDTH = 64;
+	static const int TILE_HEIGHT = 32;
+	static_assert(TILE_WIDTH % RASTER_BLOCK == 0, "Tiles must be a whole number of rasterizer blocks wide");
+
+	int nWidth = 0, nHeight = 0;
+	int nTilesX = 0, nTilesY = 0;
+	std::vector<std::vector<const triangle*>> bins;
+
+	// Empty every bin, for a screen of nScreenWidth x nScreenHeight cells
+	void Clear(int nScreenWidth, int nScreenHeight)
+	{
+		if (nScreenWidth != nWidth || nScreenHeight != nHeight)
+		{
+			nWidth = nScreenWidth;
+			nHeight = nScreenHeight;
+			nTilesX = (nWidth + TILE_WIDTH - 1) / TILE_WIDTH;
+			nTilesY = (nHeight + TILE_HEIGHT - 1) / TILE_HEIGHT;
+			bins.resize(nTilesX * nTilesY);
+		}
+		for (auto& bin : bins)
+			bin.clear();
+	}
+
+	int Count() const { return nTilesX * nTilesY; }
+
+	// Cells of tile i, cut short at the right and bottom of the screen
+	rasterRect Rect(int i) const
+	{
+		rasterRect rc;
+		rc.nLeft = (i % nTilesX) * TILE_WIDTH;
+		rc.nTop = (i / nTilesX) * TILE_HEIGHT;
+		rc.nRight = rc.nLeft + TILE_WIDTH < nWidth ? rc.nLeft + TILE_WIDTH : nWidth;
+		rc.nBottom = rc.nTop + TILE_HEIGHT < nHeight ? rc.nTop + TILE_HEIGHT : nHeight;
+		return rc;
+	}
+
+	// Add a triangle with corners in cells to the bin of every tile its bounding
+	// box touches. The box covers the cells of both rasterizers: the scanline one
+	// rounds corners down, the half-space one rounds them to the nearest 1/16 of
+	// a cell, which can carry a corner just short of a cell boundary over it
+	void Add(const triangle& t)
+	{
+		const float fSnap = 0.5f / (float)(1 << RASTER_SUBPIXEL_BITS);
+		float fMinX = t.p[0].x < t.p[1].x ? t.p[0].x : t.p[1].x; if (t.p[2].x < fMinX) fMinX = t.p[2].x;
+		float fMaxX = t.p[0].x > t.p[1].x ? t.p[0].x : t.p[1].x; if (t.p[2].x > fMaxX) fMaxX = t.p[2].x;
+		float fMinY = t.p[0].y < t.p[1].y ? t.p[0].y : t.p[1].y; if (t.p[2].y < fMinY) fMinY = t.p[2].y;
+		float fMaxY = t.p[0].y > t.p[1].y ? t.p[0].y : t.p[1].y; if (t.p[2].y > fMaxY) fMaxY = t.p[2].y;
+
+		int nMinX = (int)floorf(fMinX), nMaxX = (int)floorf(fMaxX + fSnap);
+		int nMinY = (int)floorf(fMinY), nMaxY = (int)floorf(fMaxY + fSnap);
+		if (nMaxX < 0 || nMaxY < 0 || nMinX >= nWidth || nMinY >= nHeight)
+			return;
+
+		int nTileX0 = nMinX < 0 ? 0 : nMinX / TILE_WIDTH;
+		int nTileY0 = nMinY < 0 ? 0 : nMinY / TILE_HEIGHT;
+		int nTileX1 = nMaxX >= nWidth ? nTilesX - 1 : nMaxX / TILE_WIDTH;
+		int nTileY1 = nMaxY >= nHeight ? nTilesY - 1 : nMaxY / TILE_HEIGHT;
+		for (int ty = nTileY0; ty <= nTileY1; ty++)
+			for (int tx = nTileX0; tx <= nTileX1; tx++)
+				bins[ty * nTilesX + tx].push_back(&t);
+	}
+
+	void Add(const std::vector<triangle>& vecTriangles)
+	{
+		for (auto& t : vecTriangles)
+			Add(t);
+	}
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Simd.h"
+
+// Screen positions of a whole mesh, one array per component like the mesh's
+// own position streams. x and y are in console cells, z is the projected depth
+// z / w and w is the clip space w, which the projection matrix sets to the
+// view space z so it doubles as the distance in front of the camera
+struct screenVerts
+{
+	std::vector<float> x, y, z, w;
+
+	void Resize(uint32_t n)
+	{
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		w.resize(n);
+	}
+};
+
+// Transform n positions given as separate x, y and z arrays by m and divide by
+// w, writing the results to out (which must already hold n entries). m is the
+// whole chain from model to screen, viewport included (see Matrix_Viewport), so
+// each vertex costs one matrix transform and one reciprocal. Four vertices are
+// done at a time with SSE, and the plain C++ loop used for the rest (or for
+// everything without SSE) does the same sums in the same order, so both give
+// the same results.
+// Vertices on or behind the camera (w <= 0) come out as infinities or NaNs in
+// x, y and z, callers must check w before using them
+inline void Transform_Batch(const mat4x4& m, const float* px, const float* py, const float* pz, uint32_t n, screenVerts& out)
+{
+	float* ox = out.x.data();
+	float* oy = out.y.data();
+	float* oz = out.z.data();
+	float* ow = out.w.data();
+	uint32_t i = 0;
+
+#if HAMRO_SIMD
+	// Every matrix entry broadcast across a register, the same for all vertices
+	__m128 m00 = _mm_set1_ps(m.m[0][0]), m01 = _mm_set1_ps(m.m[0][1]), m02 = _mm_set1_ps(m.m[0][2]), m03 = _mm_set1_ps(m.m[0][3]);
+	__m128 m10 = _mm_set1_ps(m.m[1][0]), m11 = _mm_set1_ps(m.m[1][1]), m12 = _mm_set1_ps(m.m[1][2]), m13 = _mm_set1_ps(m.m[1][3]);
+	__m128 m20 = _mm_set1_ps(m.m[2][0]), m21 = _mm_set1_ps(m.m[2][1]), m22 = _mm_set1_ps(m.m[2][2]), m23 = _mm_set1_ps(m.m[2][3]);
+	__m128 m30 = _mm_set1_ps(m.m[3][0]), m31 = _mm_set1_ps(m.m[3][1]), m32 = _mm_set1_ps(m.m[3][2]), m33 = _mm_set1_ps(m.m[3][3]);
+	__m128 one = _mm_set1_ps(1.0f);
+
+	auto row = [](__m128 x, __m128 y, __m128 z, __m128 c0, __m128 c1, __m128 c2, __m128 c3)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, c0), _mm_mul_ps(y, c1)), _mm_mul_ps(z, c2)), c3);
+	};
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(px + i);
+		__m128 y = _mm_loadu_ps(py + i);
+		__m128 z = _mm_loadu_ps(pz + i);
+
+		__m128 cx = row(x, y, z, m00, m10, m20, m30);
+		__m128 cy = row(x, y, z, m01, m11, m21, m31);
+		__m128 cz = row(x, y, z, m02, m12, m22, m32);
+		__m128 cw = row(x, y, z, m03, m13, m23, m33);
+
+		__m128 invW = _mm_div_ps(one, cw);
+		_mm_storeu_ps(ox + i, _mm_mul_ps(cx, invW));
+		_mm_storeu_ps(oy + i, _mm_mul_ps(cy, invW));
+		_mm_storeu_ps(oz + i, _mm_mul_ps(cz, invW));
+		_mm_storeu_ps(ow + i, cw);
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		float x = px[i], y = py[i], z = pz[i];
+		float cx = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0];
+		float cy = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1];
+		float cz = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+		float cw = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+
+		float invW = 1.0f / cw;
+		ox[i] = cx * invW;
+		oy[i] = cy * invW;
+		oz[i] = cz * invW;
+		ow[i] = cw;
+	}
+}
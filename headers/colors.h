@@ -36,6 +36,18 @@ enum COLOUR
 	BG_WHITE = 0x00F0,
 };
 
+// Red, green and blue of each of the 16 console colors, as the Windows console
+// shows them by default
+inline const unsigned char* GetColourRGB(int col)
+{
+	static const unsigned char rgb[16][3] = {
+		{ 0, 0, 0 }, { 0, 0, 128 }, { 0, 128, 0 }, { 0, 128, 128 },
+		{ 128, 0, 0 }, { 128, 0, 128 }, { 128, 128, 0 }, { 192, 192, 192 },
+		{ 128, 128, 128 }, { 0, 0, 255 }, { 0, 255, 0 }, { 0, 255, 255 },
+		{ 255, 0, 0 }, { 255, 0, 255 }, { 255, 255, 0 }, { 255, 255, 255 } };
+	return rgb[col & 0x0F];
+}
+
 enum PIXEL_TYPE
 {
 	PIXEL_SOLID = 0x2588,
@@ -44,13 +56,23 @@ enum PIXEL_TYPE
 	PIXEL_QUARTER = 0x2591,
 };
 
-// Takes luminance value between 0 & 1 and returns the symbol and console color combinations
-CHAR_INFO GetColour(float lum)
+// Number of shades GetShade picks from, darkest first
+const int SHADE_COUNT = 13;
+
+// Takes luminance value between 0 & 1 and returns which of the SHADE_COUNT
+// shades it is drawn with
+inline int GetShade(float lum)
+{
+	int pixel_bw = (int)(13.0f * lum);
+	return pixel_bw >= 0 && pixel_bw < SHADE_COUNT ? pixel_bw : 0;
+}
+
+// Symbol and console color combination of each shade
+inline CHAR_INFO GetShadeColour(int shade)
 {
 	short bg_col, fg_col;
 	wchar_t sym;
-	int pixel_bw = (int)(13.0f * lum);
-	switch (pixel_bw)
+	switch (shade)
 	{
 	case 0: bg_col = BG_BLACK; fg_col = FG_BLACK; sym = PIXEL_SOLID; break;
 
@@ -76,4 +98,10 @@ CHAR_INFO GetColour(float lum)
 	c.Attributes = bg_col | fg_col;
 	c.Char.UnicodeChar = sym;
 	return c;
-}
\ No newline at end of file
+}
+
+// Takes luminance value between 0 & 1 and returns the symbol and console color combinations
+inline CHAR_INFO GetColour(float lum)
+{
+	return GetShadeColour(GetShade(lum));
+}
@@ -3,6 +3,16 @@
 #include "hamroGraphics.h"
 #include "Matrix.h"
 #include "Vector.h"
+#include "MeshManager.h"
+#include "Transform.h"
+#include "Clip.h"
+#include "Tiles.h"
+
+// Models compiled into the program, generated by tools/obj2header (see README)
+#ifdef HAMRO_EMBEDDED_MESHES
+#include "embedded/airbus.h"
+#include "embedded/mountains.h"
+#endif
 
 #include<algorithm>
 
@@ -10,51 +20,173 @@
 class hamroEngine3D : public hamroGraphics, private Matrix
 {
 private:
-	mesh meshCube, meshCube2;
-	mat4x4 matProj;	// Matrix that converts from view space to screen space
+	ThreadPool threadPool;	// Worker threads that load and parse models in the background
+	MeshManager meshes;	// Models loaded so far, shared between render modes
+	meshHandle hAirplane, hMountains;
+	matProjective matProj;	// Matrix that converts from view space to screen space
 	
 	vec3d vCamera;	// Location of camera in world space
 	vec3d vLookDir; // Direction vector along the direction camera points
+	vec3d vLightDir;	// Unit vector towards the light, normalised once in OnUserCreate
 	float fYaw;		// FPS Camera rotation in XZ plane
 	float fTheta;	// Spins World Transform
 
+	// Post-transform buffer: every vertex of the mesh being drawn in screen space,
+	// indexed like the mesh itself
+	screenVerts screenBuffer;
+	const mesh* pScreenBufferMesh = nullptr;	// Mesh in screenBuffer, and the matrix it was transformed with
+	matProjective matScreenBuffer;
+	// Post-transform buffer for packed meshes: vertices in clip space, filled in
+	// lazily. vecVertStamp holds the nProjectStamp of the last ProjectMesh call
+	// that filled each entry
+	std::vector<vec3d> vecClipVerts;
+	std::vector<uint32_t> vecVertStamp;
+	uint32_t nProjectStamp = 0;
+	const meshPacked* pStampMesh = nullptr;	// Packed mesh last projected, and its matrix
+	matProjective matStamp;
+	// Projected triangles of the airplane and the mountains, reused across frames
+	std::vector<triangle> vecTrianglesToRaster, vecTrianglesToRaster2;
+	// The same triangles sorted into screen tiles, which are drawn in parallel
+	tileBins tiles;
+	ThreadPool rasterPool;	// Threads that draw tiles alongside the game thread
+	unsigned nMaxRasterThreads;
+	unsigned nRasterThreads;	// Threads drawing tiles, the game thread included (see T)
+
+	// Submit triangles nearest first, so the depth test rejects more hidden cells.
+	// Off by default: sorting costs more than the cells it saves here (see F)
+	bool bFrontToBack = false;
+
+	// Draw the airplane and the nearest, largest clusters of terrain first, then
+	// skip the clusters they hide, found from a depth pyramid of what they drew (see O)
+	bool bOcclusion = true;
+	depthPyramid hiZ;
+	// Terrain cluster on screen that isn't an occluder, waiting to be tested
+	// against hiZ: the cells its bounding box may cover and its nearest 1 / w
+	struct clusterTest
+	{
+		uint32_t nCluster;
+		rasterRect rc;
+		float fNearest;
+	};
+	std::vector<clusterTest> vecClusterTests;
+	std::vector<uint32_t> vecOccluders;	// Terrain clusters drawn in the first pass, nearest first
+	std::vector<uint32_t> vecVisibleClusters;	// Terrain clusters drawn in the second pass
+	std::vector<float> vecClusterNearest;	// 1 / w of each cluster's nearest corner, for ordering the occluders
+	// What became of the terrain's clusters in the last frame, all 0 if they
+	// weren't culled
+	struct occlusionStats
+	{
+		uint32_t nClusters, nOffScreen, nOccluders, nHidden;
+		uint32_t nHiddenTris;	// Triangles in the hidden clusters, front and back facing
+	} occlusion = {};
+	// Frames culled so far and the triangles hidden in them, for the average in the title
+	uint64_t nOcclusionFrames = 0, nOcclusionHiddenTris = 0;
+
+	bool bLoadModelsFirst = false;	// See LoadModelsFirst
+	bool bFlyThrough = false;	// See FlyThrough
+	float fFlyTime = 0.0f;
+	const float FLY_PERIOD = 4.0f;	// Seconds to fly from one end of the mountains to the other
+
 	// Switch between AIRPLANE_ONLY and AIRPLANE_MOUNTAINS modeling
 	int renderMode = 0;
 	enum RENDER_MODE { AIRPLANE, AIRPLANE_MOUNTAINS };
 
+	// Keep the mountains quantized and compressed in memory (see MeshPacked.h)
+#ifdef HAMRO_PACKED_MESHES
+	const bool bPackTerrain = true;
+#else
+	const bool bPackTerrain = false;
+#endif
+
+	// Triangles wanted per console cell covered by a model when choosing its level of detail
+	const float LOD_TRIS_PER_CELL = 0.5f;
+
+	// How far past the screen edges, in console cells, a triangle may reach and
+	// still be drawn without clipping. FillTriangle steps along every row and
+	// edge of a triangle even where they are off screen, so this keeps that
+	// walk short while letting almost every triangle that touches an edge skip
+	// the clipper
+	const float GUARD_BAND = 256.0f;
+
+	// Terrain clusters whose bounding box covers at least this much of the
+	// screen are drawn as occluders, along with any reaching the near plane
+	const float OCCLUDER_AREA = 1.0f / 16.0f;
+
 
 public:
-	hamroEngine3D()
+	// Tiles are drawn by up to HAMRO_RASTER_THREADS threads if it is defined,
+	// otherwise by one per hardware thread. The pool always has a worker, it
+	// just isn't used when there is only the game thread to draw with
+	hamroEngine3D() : meshes(threadPool), rasterPool(MaxRasterThreads() > 1 ? MaxRasterThreads() - 1 : 1)
 	{
 		m_appName = L"3D Airplane"; // Name of application
+		nMaxRasterThreads = MaxRasterThreads();
+		nRasterThreads = nMaxRasterThreads;
 	}
 
-	bool OnUserCreate() override
+	// Start with what the keys switch already switched, for runs with no
+	// keyboard such as --headless (see main.cpp)
+	void ShowMountains() { renderMode = AIRPLANE_MOUNTAINS; }
+	void UseHalfSpace() { m_rasterizer = RASTER_HALFSPACE; }
+	void SetRasterThreads(unsigned n) { nRasterThreads = n < 1 ? 1 : (n > nMaxRasterThreads ? nMaxRasterThreads : n); }
+	void SetOcclusion(bool b) { bOcclusion = b; }
+	void SetFrontToBack(bool b) { bFrontToBack = b; }
+	// Load every model before the first frame instead of in the background
+	void LoadModelsFirst() { bLoadModelsFirst = true; }
+	// Fly the camera low through the mountains on a fixed path (see --fly)
+	void FlyThrough() { bFlyThrough = true; }
+
+	static unsigned MaxRasterThreads()
 	{
-		// Populate mesh with vertecies data from object file
-		bool isObjectLoaded = meshCube.LoadFromObjectFile("resources/airbus.obj");
-		if (!isObjectLoaded) {
-			std::cout << "Couldn't load object";
-			return 0; // Terminate program
-		}
+#ifdef HAMRO_RASTER_THREADS
+		return HAMRO_RASTER_THREADS > 0 ? HAMRO_RASTER_THREADS : 1;
+#else
+		unsigned n = std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+#endif
+	}
 
-		
-		// Another object: Mountains for second render mode
-		isObjectLoaded = meshCube2.LoadFromObjectFile("resources/mountains.obj");
-		if (!isObjectLoaded) {
-			std::cout << "Couldn't load object";
-			return 0; // Terminate program
+	bool OnUserCreate() override
+	{
+#ifdef HAMRO_EMBEDDED_MESHES
+		// Compiled in models are ready before the requests below are made
+		meshes.AddEmbedded("resources/airbus.obj", embedded::airbus);
+		meshes.AddEmbedded("resources/mountains.obj", embedded::mountains);
+#endif
+
+		// Start loading the airplane (from object file or its baked cache) in the
+		// background, frames are drawn without it until it is ready. Its levels of
+		// detail are simplified on first run and cached after that
+		hAirplane = meshes.Request("resources/airbus.obj", true);
+		if (bLoadModelsFirst)
+		{
+			hMountains = meshes.Request("resources/mountains.obj", false, bPackTerrain);
+			meshes.Wait();
 		}
 
 		// Projection Matrix
 		matProj = Matrix_Projection(90.0f, (float)ScreenHeight() / (float)ScreenWidth(), 0.1f, 1000.0f);
 
+		// Illumination
+		// This is the simplest form of lighting. It's a single direction light (this doesn't exist in real world)
+		// This light assumes that all rays of light are coming in from a single direction not a single point
+		vLightDir = Vector_Normalise({ 0.0f, 1.0f, -1.0f });	// only z-component to indicate the light is shining towards the player
+
 		// Tell game engine everything is fine and continue running
 		return true;
 	}
 
 	bool OnUserUpdate(float fElapsedTime) override
 	{
+		if (hAirplane.Failed() || hMountains.Failed()) {
+			std::cout << "Couldn't load object";
+			return false; // Terminate program
+		}
+
+		// Once the airplane is in, prefetch the mountains for the second render mode
+		if (hAirplane.Ready() && !hMountains.Valid())
+			hMountains = meshes.Request("resources/mountains.obj", false, bPackTerrain);
+
 		// On key press, switch between AIRPLANE_ONLY and AIRPLANE_MOUNTAINS mode
 		if (GetKey(L'M').bPressed) {
 			// Reset vCamera, vLookDir and fYaw
@@ -65,6 +197,22 @@ public:
 			renderMode = 1 - renderMode;
 		}
 
+		// Toggle nearest first ordering of the triangles
+		if (GetKey(L'F').bPressed)
+			bFrontToBack = !bFrontToBack;
+
+		// Switch between the scanline and half-space rasterizers
+		if (GetKey(L'H').bPressed)
+			m_rasterizer = m_rasterizer == RASTER_SCANLINE ? RASTER_HALFSPACE : RASTER_SCANLINE;
+
+		// Toggle occlusion culling of the terrain
+		if (GetKey(L'O').bPressed)
+			bOcclusion = !bOcclusion;
+
+		// Cycle the number of threads drawing tiles from 1 up to the most there are
+		if (GetKey(L'T').bPressed)
+			nRasterThreads = nRasterThreads < nMaxRasterThreads ? nRasterThreads + 1 : 1;
+
 		if (GetKey(VK_UP).bHeld)
 			vCamera.y += 1.0f * fElapsedTime;	// Travel Upwards
 
@@ -96,11 +244,24 @@ public:
 		if (GetKey(L'D').bHeld)
 			fYaw += 1.0f * fElapsedTime;
 
-
+		// Weave along the valley from one end to the other, looking from side to side
+		if (bFlyThrough)
+		{
+			fFlyTime += fElapsedTime;
+			float s = fmodf(fFlyTime / FLY_PERIOD, 1.0f);
+			vCamera = { 20.0f * sinf(6.2831853f * s), -2.0f, -70.0f + 140.0f * s };
+			fYaw = 0.8f * sinf(12.566371f * s);
+		}
 
 		// To give impression that something is rotating, define angle value that changes over time
 		fTheta += 1.0f * fElapsedTime;
 
+		// Transformed vertices are only reused within a frame, a mesh reloaded
+		// since the last one could be at the same address
+		pScreenBufferMesh = nullptr;
+		pStampMesh = nullptr;
+
+		occlusion = {};
 		switch (renderMode)
 		{
 		case AIRPLANE_MOUNTAINS:
@@ -114,525 +275,671 @@ public:
 			break;
 		}
 
+		// What occlusion culling made of the mountains, shown next to the frame rate
+		m_appName = L"3D Airplane";
+		if (occlusion.nClusters)
+		{
+			nOcclusionFrames++;
+			nOcclusionHiddenTris += occlusion.nHiddenTris;
+			wchar_t sz[256];
+			swprintf(sz, 256, L" - %u mountain clusters: %u off view, %u occluders, %u hidden (%u triangles, %.1f a frame on average)",
+				occlusion.nClusters, occlusion.nOffScreen, occlusion.nOccluders, occlusion.nHidden, occlusion.nHiddenTris,
+				(double)nOcclusionHiddenTris / (double)nOcclusionFrames);
+			m_appName += sz;
+		}
+
 		return true;
 	}
 
 	void renderAirplane()
 	{
-		mat4x4 matRotY = Matrix_RotationY(fTheta * 0.5f);
-		mat4x4 matTrans = Matrix_Translation(0.0f, 0.0f, 2.0f); // Change z-value to draw the object near or far
+		matRigid matRotY = Matrix_RotationY(fTheta * 0.5f);
+		matRigid matTrans = Matrix_Translation(0.0f, 0.0f, 2.0f); // Change z-value to draw the object near or far
 		// World matrix
-		mat4x4 matWorld;
+		matRigid matWorld;
 		matWorld = Matrix_Identity();	// Form world matrix
 		matWorld = Matrix_MultiplyMatrix(matWorld, matRotY);	// Transform by rotation
 		matWorld = Matrix_MultiplyMatrix(matWorld, matTrans);	// Transform by translation
 
-
-		// Create "Point At" Matrix for camera
-		vec3d vUp = { 0, 1, 0 };
-		vec3d vTarget = { 0, 0, 1 };
-		mat4x4 matCameraRot = Matrix_RotationY(fYaw);
-		vLookDir = Matrix_MultiplyVector(matCameraRot, vTarget);
-		vTarget = Vector_Add(vCamera, vLookDir);
-		mat4x4 matCamera = Matrix_PointAt(vCamera, vTarget, vUp);
-
 		// Make view matrix from camera
-		mat4x4 matView = Matrix_Inverse(matCamera);
+		matRigid matView = CameraViewMatrix();
 
 		// Store triangles for rasterizing later
-		std::vector<triangle> vecTrianglesToRaster;
-
-		for (auto tri : meshCube.tris)
+		vecTrianglesToRaster.clear();
+		if (hAirplane.Ready())
 		{
-			triangle triProjected, triTransformed, triViewed;
-
-			// Transform each triangle using World Matrix (ie Composite Transformation Matrix)
-			triTransformed.p[0] = Matrix_MultiplyVector(matWorld, tri.p[0]);
-			triTransformed.p[1] = Matrix_MultiplyVector(matWorld, tri.p[1]);
-			triTransformed.p[2] = Matrix_MultiplyVector(matWorld, tri.p[2]);
-
-			// Calculate triangle Normal
-			vec3d normal, line1, line2;
-			// Get lines either side of triangle
-			line1 = Vector_Sub(triTransformed.p[1], triTransformed.p[0]);
-			line2 = Vector_Sub(triTransformed.p[2], triTransformed.p[0]);
-			// Normal to triangle surface = Cross product of two lines
-			normal = Vector_CrossProduct(line1, line2);
-			// Normalize the normal i.e make unit vector
-			normal = Vector_Normalise(normal);
-
-			// Get Ray from triangle to camera
-			vec3d vCameraRay = Vector_Sub(triTransformed.p[0], vCamera);
-
-			// If ray is aligned with normal, then triangle is visible
-			if (Vector_DotProduct(normal, vCameraRay) < 0.0f)
-			{
-				/*
-				* Dot product is used to determine the similarity of two vector
-				* Dot product between line from camera to the triangle (to one of its point) and the normal
-				* i.e Vecotr_DotProduct(normal, vCameraRay)
-				*/
-
-				// Illumination
-				// This is the simplest form of lighting. It's a single direction light (this doesn't exist in real world)
-				// This light assumes that all rays of light are coming in from a single direction not a single point
-				vec3d light_direction = { 0.0f, 1.0f, -1.0f };	// only z-component to indicate the light is shining towards the player
-				// Normalize light_direction
-				light_direction = Vector_Normalise(light_direction);
-				// Dot product: How "aligned" are light direction and triangle surface normal ?
-				//float dp = max(0.1f, Vector_DotProduct(light_direction, normal));
-				float dp = ambient(light_direction, normal);
-				//float dp = specular(light_direction, normal, vCameraRay);
-				//float dp = max(0.00001, abs(Vector_DotProduct(light_direction, normal)-Vector_Length(vCameraRay)));
-
-				// Set colour and symbol value of translated triangle
-				CHAR_INFO c = GetColour(dp);
-				triTransformed.col = c.Attributes;
-				triTransformed.sym = c.Char.UnicodeChar;
-
-
-				// Convert World Space --> View Space
-				triViewed.p[0] = Matrix_MultiplyVector(matView, triTransformed.p[0]);
-				triViewed.p[1] = Matrix_MultiplyVector(matView, triTransformed.p[1]);
-				triViewed.p[2] = Matrix_MultiplyVector(matView, triTransformed.p[2]);
-				// Copy color and symbol values of transformed triangle to projected triangle
-				triViewed.col = triTransformed.col;
-				triViewed.sym = triTransformed.sym;
-
-				// Clip Viewed Triangle against near plane, this could form two additional triangles.
-				int nClippedTriangles = 0;
-				triangle clipped[2];
-				nClippedTriangles = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, triViewed, clipped[0], clipped[1]);
-
-				// We may end up with multiple triangles form the clip, so project as required
-				for (int n = 0; n < nClippedTriangles; n++)
-				{
-					// Project triangles from 3D --> 2D
-					triProjected.p[0] = Matrix_MultiplyVector(matProj, clipped[n].p[0]);
-					triProjected.p[1] = Matrix_MultiplyVector(matProj, clipped[n].p[1]);
-					triProjected.p[2] = Matrix_MultiplyVector(matProj, clipped[n].p[2]);
-					triProjected.col = clipped[n].col;
-					triProjected.sym = clipped[n].sym;
-
-					// Scale into view, we moved the normalising into cartesian space
-					// out of the matrix.vector function from the previous videos, so
-					// do this manually
-					triProjected.p[0] = Vector_Divide(triProjected.p[0], triProjected.p[0].w);
-					triProjected.p[1] = Vector_Divide(triProjected.p[1], triProjected.p[1].w);
-					triProjected.p[2] = Vector_Divide(triProjected.p[2], triProjected.p[2].w);
-
-					// X/Y are inverted so put them back
-					triProjected.p[0].x *= -1.0f;
-					triProjected.p[1].x *= -1.0f;
-					triProjected.p[2].x *= -1.0f;
-					triProjected.p[0].y *= -1.0f;
-					triProjected.p[1].y *= -1.0f;
-					triProjected.p[2].y *= -1.0f;
-
-					// Scale into view: Offset vertices into visible normalised space
-					// Projection matrix gives result triProjected betn -1 to +1 (normalized) so scale it to viewing area of the console screen
-					vec3d vOffsetView = { 1, 1, 0 };
-					for (int i = 0; i <= 2; i++) {
-						// First change values between -1 to +1 to between 0 to +2 (positive)
-						triProjected.p[i] = Vector_Add(triProjected.p[i], vOffsetView);
-						// Divide by 2 and scale it to the appropriate size of the axis using screen width and height
-						triProjected.p[i].x *= 0.5f * (float)ScreenWidth();
-						triProjected.p[i].y *= 0.5f * (float)ScreenHeight();
-					}
-
-					// Store triangles for sorting
-					vecTrianglesToRaster.push_back(triProjected);
-				}
-			}
+			const mesh& meshAirplane = SelectLOD(*hAirplane.Get(), hAirplane.LODs(), matWorld, matView);
+			ProjectMesh(meshAirplane, matWorld, matView, vCamera, true, vecTrianglesToRaster);
 		}
 
-		// Sort triangles from back to front
-		sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](triangle& t1, triangle& t2)
-			{
-				// Get mid-point value of z-components
-				float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
-				float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
-				// Draw triangles that are far first, so the triangles at front are drawn clearly
-				return z1 > z2;
-			});
+		SortTriangles(vecTrianglesToRaster);
 
 		// Clear the screen
 		Fill(0, 0, ScreenWidth(), ScreenHeight(), PIXEL_SOLID, FG_BLUE);
+		ClearDepth();
 
-		// Loop through all transformed, viewed, projected, and sorted triangles
-		for (auto& triToRaster : vecTrianglesToRaster)
-		{
-			// Clip triangles against all four screen edges, this could yield
-			// a bunch of triangles, so create a queue that we traverse to 
-			//  ensure we only test new triangles generated against planes
-			triangle clipped[2];
-			std::list<triangle> listTriangles;
-
-			// Add initial triangle
-			listTriangles.push_back(triToRaster);
-			int nNewTriangles = 1;
+		tiles.Clear(ScreenWidth(), ScreenHeight());
+		tiles.Add(vecTrianglesToRaster);
+		RasterTiles();
 
-			for (int p = 0; p < 4; p++)
-			{
-				int nTrisToAdd = 0;
-				while (nNewTriangles > 0)
-				{
-					// Take triangle from front of queue
-					triangle test = listTriangles.front();
-					listTriangles.pop_front();
-					nNewTriangles--;
-
-					// Clip it against a plane. We only need to test each 
-					// subsequent plane, against subsequent new triangles
-					// as all triangles after a plane clip are guaranteed
-					// to lie on the inside of the plane. I like how this
-					// comment is almost completely and utterly justified
-					switch (p)
-					{
-					case 0:	nTrisToAdd = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 1:	nTrisToAdd = Triangle_ClipAgainstPlane({ 0.0f, (float)ScreenHeight() - 1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 2:	nTrisToAdd = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 3:	nTrisToAdd = Triangle_ClipAgainstPlane({ (float)ScreenWidth() - 1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					}
-
-					// Clipping may yield a variable number of triangles, so
-					// add these new ones to the back of the queue for subsequent
-					// clipping against next planes
-					for (int w = 0; w < nTrisToAdd; w++)
-						listTriangles.push_back(clipped[w]);
-				}
-				nNewTriangles = listTriangles.size();
-			}
-			// Draw the triangles
-			for (auto& t : listTriangles)
-			{
-				// Rasterize Triangle
-				FillTriangle(
-					t.p[0].x, t.p[0].y,
-					t.p[1].x, t.p[1].y,
-					t.p[2].x, t.p[2].y,
-					t.sym, t.col);
-
-				// Wireframe Triangle (Outline for debugging)
-				if (GetKey(L'1').bHeld) {
-					DrawTriangle(
-						t.p[0].x, t.p[0].y,
-						t.p[1].x, t.p[1].y,
-						t.p[2].x, t.p[2].y,
-						PIXEL_SOLID, FG_BLACK);
-				}
-			}
-		}
+		if (GetKey(L'1').bHeld)
+			OutlineTriangles(vecTrianglesToRaster);
 	}
 
 	void renderAirplaneMountains()
 	{
+		// AIRPLANE
+		// ---------------------------------------------------------
+		matRigid matRotY;
+		// Rotate airplane when key 'R' is held
+		if (GetKey(L'R').bHeld)
+			matRotY = Matrix_RotationY(fTheta * 0.5f);
+		else
+			// Default constant rotation for static plane
+			matRotY = Matrix_RotationY(1.8f);
+		matRigid matTrans = Matrix_Translation(0.0f, 0.0f, 2.0f); // Change z-value to draw the object near or far
+		// World matrix
+		matRigid matWorld;
+		matWorld = Matrix_Identity();
+		matWorld.m[1][1] = -1;	// Invert image (inverted by defualt)
+		matWorld = Matrix_MultiplyMatrix(matWorld, matRotY);
+		matWorld = Matrix_MultiplyMatrix(matWorld, matTrans);	// Transform by translation
+
+		// The airplane flies with the camera, so it skips the view transform and is
+		// lit from a constant camera position so that its lighting doesn't change
+		matRigid matNoView = Matrix_Identity();
+		vec3d vCamera2;
+
+		// Store triangles for rasterizing later
+		vecTrianglesToRaster.clear();
+		if (hAirplane.Ready())
+		{
+			const mesh& meshAirplane = SelectLOD(*hAirplane.Get(), hAirplane.LODs(), matWorld, matNoView);
+			ProjectMesh(meshAirplane, matWorld, matNoView, vCamera2, false, vecTrianglesToRaster);
+		}
+
+		SortTriangles(vecTrianglesToRaster);
+		// AIRPLANE COMPLETE
+		// ---------------------------------------------------------
+
+
 		// MOUNTAINS
 		// ---------------------------------------------------------
-		mat4x4 matTrans = Matrix_Translation(0.0f, -8.0f, 2.0f); // Change z-value to draw the object near or far
+		matTrans = Matrix_Translation(0.0f, -8.0f, 2.0f); // Change z-value to draw the object near or far
 		// World matrix
-		mat4x4 matWorld;
 		matWorld = Matrix_Identity();	// Form world matrix
 		matWorld = Matrix_MultiplyMatrix(matWorld, matTrans);	// Transform by translation
 
+		// Make view matrix from camera
+		matRigid matView = CameraViewMatrix();
+
+		// Store triangles for rasterizing later, the mountains are loaded on first
+		// use if the prefetch hasn't asked for them yet. With occlusion culling
+		// only the occluders are projected for now
+		if (!hMountains.Valid())
+			hMountains = meshes.Request("resources/mountains.obj", false, bPackTerrain);
+		const meshPacked* packed = hMountains.Packed();
+		const mesh* pMountains = packed ? nullptr : hMountains.Get();
+		bool bCull = bOcclusion && (packed || pMountains);
+		auto projectMountains = [&](const std::vector<uint32_t>* pClusters)
+		{
+			if (packed)
+				ProjectMesh(*packed, matWorld, matView, vCamera, true, vecTrianglesToRaster2, pClusters);
+			else if (pMountains)
+				ProjectMesh(*pMountains, matWorld, matView, vCamera, true, vecTrianglesToRaster2, pClusters);
+		};
+
+		vecTrianglesToRaster2.clear();
+		if (bCull)
+			SortClusters(hMountains.Clusters(), matWorld, matView);
+		projectMountains(bCull ? &vecOccluders : nullptr);
+
+		SortTriangles(vecTrianglesToRaster2);
+		// MOUNTAINS COMPLETE
+		// ---------------------------------------------------------
+
+		// Clear the screen
+		Fill(0, 0, ScreenWidth(), ScreenHeight(), PIXEL_SOLID, FG_BLUE);
+		ClearDepth();
 
-		// Create "Point At" Matrix for camera
+		// The depth buffer sorts out which is in front, the airplane goes first
+		// since it is nearest and hides the most. Each tile draws its triangles in
+		// the order they are added
+		tiles.Clear(ScreenWidth(), ScreenHeight());
+		// DRAW AIRPLANE
+		// ---------------------------------------------------------
+		tiles.Add(vecTrianglesToRaster);
+
+		// DRAW MOUNTAINS
+		// ---------------------------------------------------------
+		tiles.Add(vecTrianglesToRaster2);
+		RasterTiles();
+
+		if (bCull && !vecClusterTests.empty())
+		{
+			// Then the rest of the terrain that what is drawn doesn't hide
+			hiZ.Build(m_bufDepth, ScreenWidth(), ScreenHeight());
+			CullHiddenClusters(packed ? packed->nTris : pMountains->nTris);
+			size_t nFirst = vecTrianglesToRaster2.size();
+			projectMountains(&vecVisibleClusters);
+			SortTriangles(vecTrianglesToRaster2, nFirst);
+
+			tiles.Clear(ScreenWidth(), ScreenHeight());
+			for (size_t i = nFirst; i < vecTrianglesToRaster2.size(); i++)
+				tiles.Add(vecTrianglesToRaster2[i]);
+			RasterTiles();
+		}
+
+		if (GetKey(L'1').bHeld)
+		{
+			OutlineTriangles(vecTrianglesToRaster);
+			OutlineTriangles(vecTrianglesToRaster2);
+		}
+	}
+
+private:
+	// Create "Point At" Matrix for camera and invert it to get the view matrix
+	matRigid CameraViewMatrix()
+	{
 		vec3d vUp = { 0, 1, 0 };
 		vec3d vTarget = { 0, 0, 1 };
-		mat4x4 matCameraRot = Matrix_RotationY(fYaw);
+		matRigid matCameraRot = Matrix_RotationY(fYaw);
 		vLookDir = Matrix_MultiplyVector(matCameraRot, vTarget);
 		vTarget = Vector_Add(vCamera, vLookDir);
-		mat4x4 matCamera = Matrix_PointAt(vCamera, vTarget, vUp);
+		matRigid matCamera = Matrix_PointAt(vCamera, vTarget, vUp);
 
-		// Make view matrix from camera
-		mat4x4 matView = Matrix_Inverse(matCamera);
+		return Matrix_Inverse(matCamera);
+	}
 
-		// Store triangles for rasterizing later
-		std::vector<triangle> vecTrianglesToRaster2;
+	// Pick the simplest level of detail that still has about LOD_TRIS_PER_CELL
+	// triangles for each console cell covered by the mesh's projected bounding
+	// sphere, so a distant or low resolution model isn't drawn in full
+	const mesh& SelectLOD(const mesh& full, const std::vector<mesh>& lods, const matRigid& matWorld, const matRigid& matView)
+	{
+		float fRadius = full.fRadius;
+
+		vec3d vWorld = Matrix_MultiplyVector(matWorld, full.vCentre);
+		vec3d vView = Matrix_MultiplyVector(matView, vWorld);
+		if (vView.z - fRadius <= 0.1f)
+			return full;	// Sphere reaches the near plane, it can cover the whole screen
+
+		// Radius in console cells: projection scales y by m[1][1] / z into -1..+1, which spans ScreenHeight()
+		float fCells = fRadius * matProj.m[1][1] / vView.z * 0.5f * (float)ScreenHeight();
+		float fTargetTris = LOD_TRIS_PER_CELL * 3.14159f * fCells * fCells;
+
+		const mesh* pBest = &full;
+		for (auto& lod : lods)
+		{
+			if ((float)lod.nTris < fTargetTris)
+				break;
+			pBest = &lod;
+		}
+		return *pBest;
+	}
 
-		for (auto tri : meshCube2.tris)
+	// Transform, light, clip against the near plane and project every visible triangle
+	// of a mesh, appending the screen space triangles to vecOut. vEye is the world space
+	// position used for backface culling. bFlipXY puts back the X/Y inverted by projection.
+	// The world matrix is rigid (rotation, mirroring and translation only) so lit normals stay unit length.
+	// Given pClusters, only the triangles of those clusters (see Occlusion.h) are projected, in that order
+	void ProjectMesh(const mesh& m, const matRigid& matWorld, const matRigid& matView, const vec3d& vEye, bool bFlipXY, std::vector<triangle>& vecOut,
+		const std::vector<uint32_t>* pClusters = nullptr)
+	{
+		// Cull in object space: bring the eye into the model's own frame instead of
+		// taking every triangle to world space. A mirroring world matrix flips the
+		// winding, and with it which side of each face plane is the front
+		matRigid matInvWorld = Matrix_Inverse(matWorld);
+		vec3d vEyeLocal = Matrix_MultiplyVector(matInvWorld, vEye);
+		float fFacing = Matrix_Determinant3x3(matWorld) < 0.0f ? -1.0f : 1.0f;
+
+		// Normals go to world space for lighting through their own matrix, since
+		// the vertices skip world space altogether
+		matAffine matNormal = Matrix_NormalMatrix(matWorld);
+
+		// Take every vertex straight to the screen in one pass over the position
+		// streams, with world, view, projection and viewport concatenated into one
+		// matrix. That includes vertices only back faces use, but doing four at
+		// a time with no per vertex bookkeeping still costs less than doing half
+		// of them one by one, and each shared vertex is projected once instead of
+		// once for every triangle that uses it. Projecting more clusters of the
+		// same mesh with the same matrix, as the second pass of occlusion culling
+		// does, reuses the vertices
+		matRigid matWorldView = Matrix_MultiplyMatrix(matWorld, matView);
+		matProjective matWorldToScreen = Matrix_MultiplyMatrix(matWorldView, ProjectionToScreen(bFlipXY));
+		if (pScreenBufferMesh != &m || memcmp(&matScreenBuffer, &matWorldToScreen, sizeof(matWorldToScreen)) != 0)
+		{
+			screenBuffer.Resize(m.nVerts);
+			Transform_Batch(matWorldToScreen, m.pX, m.pY, m.pZ, m.nVerts, screenBuffer);
+			pScreenBufferMesh = &m;
+			matScreenBuffer = matWorldToScreen;
+		}
+		const float* sx = screenBuffer.x.data();
+		const float* sy = screenBuffer.y.data();
+		const float* sz = screenBuffer.z.data();
+		const float* sw = screenBuffer.w.data();
+
+		uint32_t nRanges = pClusters ? (uint32_t)pClusters->size() : 1;
+		for (uint32_t iRange = 0; iRange < nRanges; iRange++)
 		{
-			triangle triProjected, triTransformed, triViewed;
-
-			// Transform each triangle using World Matrix (ie Composite Transformation Matrix)
-			triTransformed.p[0] = Matrix_MultiplyVector(matWorld, tri.p[0]);
-			triTransformed.p[1] = Matrix_MultiplyVector(matWorld, tri.p[1]);
-			triTransformed.p[2] = Matrix_MultiplyVector(matWorld, tri.p[2]);
-
-			// Calculate triangle Normal
-			vec3d normal, line1, line2;
-			// Get lines either side of triangle
-			line1 = Vector_Sub(triTransformed.p[1], triTransformed.p[0]);
-			line2 = Vector_Sub(triTransformed.p[2], triTransformed.p[0]);
-			// Normal to triangle surface = Cross product of two lines
-			normal = Vector_CrossProduct(line1, line2);
-			// Normalize the normal i.e make unit vector
-			normal = Vector_Normalise(normal);
-
-			// Get Ray from triangle to camera
-			vec3d vCameraRay = Vector_Sub(triTransformed.p[0], vCamera);
-
-			// If ray is aligned with normal, then triangle is visible
-			if (Vector_DotProduct(normal, vCameraRay) < 0.0f)
+			uint32_t nFirst = 0, nEnd = m.nTris;
+			if (pClusters)
 			{
-				// Illumination
-				vec3d light_direction = { 0.0f, 1.0f, -1.0f };
-				// Normalize light_direction
-				light_direction = Vector_Normalise(light_direction);
-				// Dot product: How "aligned" are light direction and triangle surface normal ?
-				float dp = max(0.1f, Vector_DotProduct(light_direction, normal));
-
-				// Set colour and symbol value of translated triangle
-				CHAR_INFO c = GetColour(dp);
-				triTransformed.col = c.Attributes;
-				triTransformed.sym = c.Char.UnicodeChar;
-
-
-				// Convert World Space --> View Space
-				triViewed.p[0] = Matrix_MultiplyVector(matView, triTransformed.p[0]);
-				triViewed.p[1] = Matrix_MultiplyVector(matView, triTransformed.p[1]);
-				triViewed.p[2] = Matrix_MultiplyVector(matView, triTransformed.p[2]);
-				// Copy color and symbol values of transformed triangle to projected triangle
-				triViewed.col = triTransformed.col;
-				triViewed.sym = triTransformed.sym;
-
-				// Clip Viewed Triangle against near plane, this could form two additional triangles.
-				int nClippedTriangles = 0;
-				triangle clipped[2];
-				nClippedTriangles = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, triViewed, clipped[0], clipped[1]);
-
-				// We may end up with multiple triangles form the clip, so project as required
-				for (int n = 0; n < nClippedTriangles; n++)
+				nFirst = (*pClusters)[iRange] * CLUSTER_TRIS;
+				nEnd = nFirst + CLUSTER_TRIS < m.nTris ? nFirst + CLUSTER_TRIS : m.nTris;
+			}
+
+			for (uint32_t iTri = nFirst; iTri < nEnd; iTri++)
+			{
+				// Signed distance of the eye from the face plane, the triangle is
+				// visible only if the eye is in front of it
+				const vec3d& plane = m.pPlanes[iTri];
+				float fEyeDist = plane.x * vEyeLocal.x + plane.y * vEyeLocal.y + plane.z * vEyeLocal.z + plane.w;
+				if (fFacing * fEyeDist > 0.0f)
 				{
-					// Project triangles from 3D --> 2D
-					triProjected.p[0] = Matrix_MultiplyVector(matProj, clipped[n].p[0]);
-					triProjected.p[1] = Matrix_MultiplyVector(matProj, clipped[n].p[1]);
-					triProjected.p[2] = Matrix_MultiplyVector(matProj, clipped[n].p[2]);
-					triProjected.col = clipped[n].col;
-					triProjected.sym = clipped[n].sym;
-
-					// Scale into view, normalise manually
-					triProjected.p[0] = Vector_Divide(triProjected.p[0], triProjected.p[0].w);
-					triProjected.p[1] = Vector_Divide(triProjected.p[1], triProjected.p[1].w);
-					triProjected.p[2] = Vector_Divide(triProjected.p[2], triProjected.p[2].w);
-
-					// X/Y are inverted so put them back
-					triProjected.p[0].x *= -1.0f;
-					triProjected.p[1].x *= -1.0f;
-					triProjected.p[2].x *= -1.0f;
-					triProjected.p[0].y *= -1.0f;
-					triProjected.p[1].y *= -1.0f;
-					triProjected.p[2].y *= -1.0f;
-
-					// Scale into view: Offset vertices into visible normalised space
-					// Projection matrix gives result triProjected betn -1 to +1 (normalized) so scale it to viewing area of the console screen
-					vec3d vOffsetView = { 1, 1, 0 };
-					for (int i = 0; i <= 2; i++) {
-						// First change values between -1 to +1 to between 0 to +2 (positive)
-						triProjected.p[i] = Vector_Add(triProjected.p[i], vOffsetView);
-						// Divide by 2 and scale it to the appropriate size of the axis using screen width and height
-						triProjected.p[i].x *= 0.5f * (float)ScreenWidth();
-						triProjected.p[i].y *= 0.5f * (float)ScreenHeight();
+					const uint32_t* idx = &m.pIndices[3 * iTri];
+					GUARD_BAND_TEST test = NEEDS_CLIPPING;
+					triangle triProjected;
+					if (sw[idx[0]] >= 0.1f && sw[idx[1]] >= 0.1f && sw[idx[2]] >= 0.1f)
+					{
+						// Wholly in front of the near plane, the batch has already projected it
+						for (int k = 0; k < 3; k++)
+							triProjected.p[k] = { sx[idx[k]], sy[idx[k]], sz[idx[k]], 1.0f / sw[idx[k]] };
+						test = TestGuardBand(triProjected);
 					}
+					if (test == OFF_SCREEN)
+						continue;
 
-					// Store triangles for sorting
-					vecTrianglesToRaster2.push_back(triProjected);
+					// Rotate the precomputed normal into world space for lighting
+					vec3d vPlaneNormal = { plane.x, plane.y, plane.z, 0.0f };
+					uint8_t nShade = ShadeTriangle(Matrix_MultiplyVector(matNormal, vPlaneNormal));
+
+					if (test == IN_GUARD_BAND)
+					{
+						triProjected.shade = nShade;
+						vecOut.push_back(triProjected);
+					}
+					else
+					{
+						// Crosses the near plane or reaches past the guard band, clip it
+						triangle triClip;
+						for (int k = 0; k < 3; k++)
+							triClip.p[k] = Matrix_MultiplyVector(matWorldToScreen, m.Vertex(idx[k]));
+						triClip.shade = nShade;
+						ClipAndProjectTriangle(triClip, vecOut);
+					}
 				}
 			}
 		}
+	}
 
-		// Sort triangles from back to front
-		sort(vecTrianglesToRaster2.begin(), vecTrianglesToRaster2.end(), [](triangle& t1, triangle& t2)
-			{
-				// Get mid-point value of z-components
-				float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
-				float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
-				// Draw triangles that are far first, so the triangles at front are drawn clearly
-				return z1 > z2;
-			});
-		// MOUNTAINS COMPLETE
-		// ---------------------------------------------------------
-
-
-		// AIRPLANE
-		// ---------------------------------------------------------
-		mat4x4 matRotY;
-		// Rotate airplane when key 'R' is held
-		if (GetKey(L'R').bHeld)
-			matRotY = Matrix_RotationY(fTheta * 0.5f);
-		else
-			// Default constant rotation for static plane
-			matRotY = Matrix_RotationY(1.8f);
-		matTrans = Matrix_Translation(0.0f, 0.0f, 2.0f); // Change z-value to draw the object near or far
-		// World matrix
-		matWorld = Matrix_Identity();
-		matWorld.m[1][1] = -1;	// Invert image (inverted by defualt)
-		matWorld = Matrix_MultiplyMatrix(matWorld, matRotY);
-		matWorld = Matrix_MultiplyMatrix(matWorld, matTrans);	// Transform by translation
-		// Store triangles for rasterizing later
-		std::vector<triangle> vecTrianglesToRaster;
+	// Same as above for a packed mesh. The dequantisation is folded into the world
+	// matrix, and faces are culled in quantized space using planes worked out from
+	// the quantized positions. Quantizing only scales and offsets the model, so a
+	// face points the same way in either space. A packed mesh's clusters are its index blocks
+	void ProjectMesh(const meshPacked& m, const matRigid& matWorld, const matRigid& matView, const vec3d& vEye, bool bFlipXY, std::vector<triangle>& vecOut,
+		const std::vector<uint32_t>* pClusters = nullptr)
+	{
+		matAffine matDequant = Matrix_Identity();
+		matDequant.m[0][0] = m.vQuantScale.x;
+		matDequant.m[1][1] = m.vQuantScale.y;
+		matDequant.m[2][2] = m.vQuantScale.z;
+		matDequant.m[3][0] = m.vQuantOffset.x;
+		matDequant.m[3][1] = m.vQuantOffset.y;
+		matDequant.m[3][2] = m.vQuantOffset.z;
+		matAffine matQuantWorld = Matrix_MultiplyMatrix(matDequant, matWorld);
+		matAffine matQuantView = Matrix_MultiplyMatrix(matQuantWorld, matView);
+		matProjective matQuantToScreen = Matrix_MultiplyMatrix(matQuantView, ProjectionToScreen(bFlipXY));
+		matAffine matNormal = Matrix_NormalMatrix(matWorld);
+
+		matRigid matInvWorld = Matrix_Inverse(matWorld);
+		vec3d vEyeLocal = Matrix_MultiplyVector(matInvWorld, vEye);
+		float fEyeQx = (vEyeLocal.x - m.vQuantOffset.x) / m.vQuantScale.x;
+		float fEyeQy = (vEyeLocal.y - m.vQuantOffset.y) / m.vQuantScale.y;
+		float fEyeQz = (vEyeLocal.z - m.vQuantOffset.z) / m.vQuantScale.z;
+		float fFacing = Matrix_Determinant3x3(matWorld) < 0.0f ? -1.0f : 1.0f;
+
+		// Vertices already transformed by an earlier call for the same mesh and
+		// matrix are still good
+		if (pStampMesh != &m || memcmp(&matStamp, &matQuantToScreen, sizeof(matQuantToScreen)) != 0)
+		{
+			nProjectStamp++;
+			pStampMesh = &m;
+			matStamp = matQuantToScreen;
+		}
+		vecClipVerts.resize(m.nVerts);
+		vecVertStamp.resize(m.nVerts, 0);
 
-		for (auto& tri : meshCube.tris)
+		uint32_t nBlocks = pClusters ? (uint32_t)pClusters->size() : (uint32_t)m.blocks.size();
+		for (uint32_t iList = 0; iList < nBlocks; iList++)
 		{
-			triangle triProjected, triTransformed;
-
-			// Transform each triangle using World Matrix (ie Composite Transformation Matrix)
-			triTransformed.p[0] = Matrix_MultiplyVector(matWorld, tri.p[0]);
-			triTransformed.p[1] = Matrix_MultiplyVector(matWorld, tri.p[1]);
-			triTransformed.p[2] = Matrix_MultiplyVector(matWorld, tri.p[2]);
-
-			// Calculate triangle Normal
-			vec3d normal, line1, line2;
-			// Get lines either side of triangle
-			line1 = Vector_Sub(triTransformed.p[1], triTransformed.p[0]);
-			line2 = Vector_Sub(triTransformed.p[2], triTransformed.p[0]);
-			// Normal to triangle surface = Cross product of two lines
-			normal = Vector_CrossProduct(line1, line2);
-			// Normalize the normal i.e make unit vector
-			normal = Vector_Normalise(normal);
-
-			// Get Ray from triangle to camera
-			vec3d vCamera2;	// Constant camera for airplane flying in mountains so that, its lighting doesn't change
-			vec3d vCameraRay = Vector_Sub(triTransformed.p[0], vCamera2);
-
-			// If ray is aligned with normal, then triangle is visible
-			if (Vector_DotProduct(normal, vCameraRay) < 0.0f)
+			uint32_t iBlock = pClusters ? (*pClusters)[iList] : iList;
+			const packedIndexBlock& block = m.blocks[iBlock];
+			uint32_t nBlockTris = m.nTris - iBlock * INDEX_BLOCK_TRIS;
+			if (nBlockTris > INDEX_BLOCK_TRIS)
+				nBlockTris = INDEX_BLOCK_TRIS;
+			// Decode and cull the whole block first, without branching on the result.
+			// Deciding each triangle straight after decoding it stalls on a badly
+			// predicted branch at the end of a long chain of loads and arithmetic
+			uint32_t blockIdx[3 * INDEX_BLOCK_TRIS];
+			uint32_t visible[INDEX_BLOCK_TRIS];
+			uint32_t nVisible = 0;
+			for (uint32_t iTri = 0; iTri < nBlockTris; iTri++)
 			{
-				// Illumination
-				vec3d light_direction = { 0.0f, 1.0f, -1.0f };
-				// Normalize light_direction
-				light_direction = Vector_Normalise(light_direction);
-				// Dot product: How "aligned" are light direction and triangle surface normal ?
-				float dp = max(0.1f, Vector_DotProduct(light_direction, normal));
-
-				// Set colour and symbol value of translated triangle
-				CHAR_INFO c = GetColour(dp);
-				triTransformed.col = c.Attributes;
-				triTransformed.sym = c.Char.UnicodeChar;
-
-
-				// Project triangles form 3D --> 2D
-				triProjected.p[0] = Matrix_MultiplyVector(matProj, triTransformed.p[0]);
-				triProjected.p[1] = Matrix_MultiplyVector(matProj, triTransformed.p[1]);
-				triProjected.p[2] = Matrix_MultiplyVector(matProj, triTransformed.p[2]);
-				// Copy color and symbol values of transformed triangle to projected triangle
-				triProjected.col = triTransformed.col;
-				triProjected.sym = triTransformed.sym;
-				// Normalize the coordinates
-				triProjected.p[0] = Vector_Divide(triProjected.p[0], triProjected.p[0].w);
-				triProjected.p[1] = Vector_Divide(triProjected.p[1], triProjected.p[1].w);
-				triProjected.p[2] = Vector_Divide(triProjected.p[2], triProjected.p[2].w);
-
-
-				// Scale into view: Offset vertices into visible normalised space
-				// Projection matrix gives result triProjected betn -1 to +1 (normalized) so scale it to viewing area of the console screen
-				vec3d vOffsetView = { 1, 1, 0 };
-				for (int i = 0; i <= 2; i++) {
-					// First change values between -1 to +1 to between 0 to +2 (positive)
-					triProjected.p[i] = Vector_Add(triProjected.p[i], vOffsetView);
-					// Divide by 2 and scale it to the appropriate size of the axis using screen width and height
-					triProjected.p[i].x *= 0.5f * (float)ScreenWidth();
-					triProjected.p[i].y *= 0.5f * (float)ScreenHeight();
+				uint32_t* idx = &blockIdx[3 * iTri];
+				idx[0] = Mesh_ReadIndex(m.indexData.data(), block, 3 * iTri + 0);
+				idx[1] = Mesh_ReadIndex(m.indexData.data(), block, 3 * iTri + 1);
+				idx[2] = Mesh_ReadIndex(m.indexData.data(), block, 3 * iTri + 2);
+
+				// Unnormalised face normal in quantized space, enough to tell which side the eye is on
+				const packedVertex& q0 = m.verts[idx[0]];
+				const packedVertex& q1 = m.verts[idx[1]];
+				const packedVertex& q2 = m.verts[idx[2]];
+				float ux = (float)q1.x - q0.x, uy = (float)q1.y - q0.y, uz = (float)q1.z - q0.z;
+				float vx = (float)q2.x - q0.x, vy = (float)q2.y - q0.y, vz = (float)q2.z - q0.z;
+				float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+				float fEyeDist = nx * (fEyeQx - q0.x) + ny * (fEyeQy - q0.y) + nz * (fEyeQz - q0.z);
+				visible[nVisible] = iTri;
+				nVisible += fFacing * fEyeDist > 0.0f;
+			}
+
+			for (uint32_t i = 0; i < nVisible; i++)
+			{
+				const uint32_t* idx = &blockIdx[3 * visible[i]];
+				for (int k = 0; k < 3; k++)
+				{
+					if (vecVertStamp[idx[k]] != nProjectStamp)
+					{
+						const packedVertex& q = m.verts[idx[k]];
+						vec3d v = { (float)q.x, (float)q.y, (float)q.z };
+						vecClipVerts[idx[k]] = Matrix_MultiplyVector(matQuantToScreen, v);
+						vecVertStamp[idx[k]] = nProjectStamp;
+					}
 				}
 
-				// Store triangles for sorting
-				vecTrianglesToRaster.push_back(triProjected);
+				// Assemble the clip space triangle from the post-transform buffer
+				triangle triClip;
+				triClip.p[0] = vecClipVerts[idx[0]];
+				triClip.p[1] = vecClipVerts[idx[1]];
+				triClip.p[2] = vecClipVerts[idx[2]];
+
+				GUARD_BAND_TEST test = NEEDS_CLIPPING;
+				triangle triProjected;
+				if (triClip.p[0].w >= 0.1f && triClip.p[1].w >= 0.1f && triClip.p[2].w >= 0.1f)
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						const vec3d& p = triClip.p[k];
+						float fInvW = 1.0f / p.w;
+						triProjected.p[k] = { p.x * fInvW, p.y * fInvW, p.z * fInvW, fInvW };
+					}
+					test = TestGuardBand(triProjected);
+				}
+				if (test == OFF_SCREEN)
+					continue;
+
+				// Face normal in object space, then world space for lighting
+				vec3d p0 = m.Dequantize(m.verts[idx[0]]);
+				vec3d p1 = m.Dequantize(m.verts[idx[1]]);
+				vec3d p2 = m.Dequantize(m.verts[idx[2]]);
+				vec3d line1 = Vector_Sub(p1, p0);
+				vec3d line2 = Vector_Sub(p2, p0);
+				vec3d vFaceNormal = Vector_CrossProduct(line1, line2);
+				vFaceNormal = Vector_Normalise(vFaceNormal);
+				vFaceNormal.w = 0.0f;
+				uint8_t nShade = ShadeTriangle(Matrix_MultiplyVector(matNormal, vFaceNormal));
+
+				if (test == IN_GUARD_BAND)
+				{
+					triProjected.shade = nShade;
+					vecOut.push_back(triProjected);
+				}
+				else
+				{
+					triClip.shade = nShade;
+					ClipAndProjectTriangle(triClip, vecOut);
+				}
 			}
 		}
+	}
+
+	// Shade of a front facing triangle with the given world space normal
+	uint8_t ShadeTriangle(const vec3d& normal)
+	{
+		// Dot product: How "aligned" are light direction and triangle surface normal ?
+		float dp = ambient(vLightDir, normal);
+
+		// Shades are the first palette entries, at their own numbers
+		return (uint8_t)GetShade(dp);
+	}
 
-		// Sort triangles from back to front
-		sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](triangle& t1, triangle& t2)
+	// Projection followed by the viewport: View Space to console cells once
+	// divided by w. X/Y are inverted by the projection, bFlipXY puts them back
+	matProjective ProjectionToScreen(bool bFlipXY)
+	{
+		// Scale into view: -1 .. +1 is offset to 0 .. 2, then halved and scaled to the console size
+		float fFlip = bFlipXY ? -1.0f : 1.0f;
+		float fHalfWidth = 0.5f * (float)ScreenWidth(), fHalfHeight = 0.5f * (float)ScreenHeight();
+		return Matrix_MultiplyMatrix(matProj, Matrix_Viewport(fFlip * fHalfWidth, fHalfWidth, fFlip * fHalfHeight, fHalfHeight));
+	}
+
+	// Where a projected triangle lies relative to the screen and the guard band
+	// around it
+	enum GUARD_BAND_TEST { OFF_SCREEN, IN_GUARD_BAND, NEEDS_CLIPPING };
+
+	// Triangles on screen, or crossing its edges but staying within GUARD_BAND
+	// cells of them, are drawn without clipping: FillTriangle clamps its spans to
+	// the screen. Takes corners already divided by w, so only for triangles
+	// wholly in front of the near plane
+	GUARD_BAND_TEST TestGuardBand(const triangle& tri)
+	{
+		float fRight = (float)ScreenWidth() - 1, fBottom = (float)ScreenHeight() - 1;
+		float fMinX = tri.p[0].x, fMaxX = fMinX;
+		float fMinY = tri.p[0].y, fMaxY = fMinY;
+		for (int i = 1; i < 3; i++)
+		{
+			const vec3d& p = tri.p[i];
+			if (p.x < fMinX) fMinX = p.x;
+			if (p.x > fMaxX) fMaxX = p.x;
+			if (p.y < fMinY) fMinY = p.y;
+			if (p.y > fMaxY) fMaxY = p.y;
+		}
+
+		if (fMaxX < 0.0f || fMinX > fRight || fMaxY < 0.0f || fMinY > fBottom)
+			return OFF_SCREEN;
+		if (fMinX >= -GUARD_BAND && fMaxX <= fRight + GUARD_BAND &&
+			fMinY >= -GUARD_BAND && fMaxY <= fBottom + GUARD_BAND)
+			return IN_GUARD_BAND;
+		return NEEDS_CLIPPING;
+	}
+
+	// Clip a lit clip space triangle (corners from a matrix ending with
+	// ProjectionToScreen) against the near plane and the outer edges of the
+	// guard band in one pass, then divide by w and queue the resulting polygon
+	// as a fan of triangles. Any new corners at the sides are off screen, so the
+	// edges that are on screen stay where they were. Nothing here touches the heap
+	void ClipAndProjectTriangle(const triangle& triClip, std::vector<triangle>& vecOut)
+	{
+		clipBounds bounds = { 0.1f, 1000.0f, -GUARD_BAND, -GUARD_BAND,
+			(float)ScreenWidth() - 1 + GUARD_BAND, (float)ScreenHeight() - 1 + GUARD_BAND };
+		clipPolygon poly;
+		Clip_Polygon(triClip, CLIP_NEAR | CLIP_SCREEN, bounds, poly);
+
+		// Divide by w the same way Transform_Batch does
+		vec3d projected[clipPolygon::MAX_VERTS];
+		for (int i = 0; i < poly.nVerts; i++)
+		{
+			const vec3d& p = poly.p[i];
+			float fInvW = 1.0f / p.w;
+			projected[i] = { p.x * fInvW, p.y * fInvW, p.z * fInvW, fInvW };
+		}
+
+		for (int i = 2; i < poly.nVerts; i++)
+		{
+			triangle triProjected;
+			triProjected.p[0] = projected[0];
+			triProjected.p[1] = projected[i - 1];
+			triProjected.p[2] = projected[i];
+			triProjected.shade = triClip.shade;
+
+			// Store triangles for sorting
+			vecOut.push_back(triProjected);
+		}
+	}
+
+	// The depth buffer decides what is in front, so the order only affects
+	// speed: drawing the nearest triangles first lets the depth test turn away
+	// the cells they hide before anything is drawn there. Triangles before
+	// nFirst are left where they are
+	void SortTriangles(std::vector<triangle>& vecTriangles, size_t nFirst = 0)
+	{
+		if (!bFrontToBack)
+			return;
+
+		sort(vecTriangles.begin() + nFirst, vecTriangles.end(), [](triangle& t1, triangle& t2)
 			{
 				// Get mid-point value of z-components
 				float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
 				float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
-				// Draw triangles that are far first, so the triangles at front are drawn clearly
-				return z1 > z2;
+				return z1 < z2;
 			});
-		// AIRPLANE COMPLETE
-		// ---------------------------------------------------------
-
-		// Clear the screen
-		Fill(0, 0, ScreenWidth(), ScreenHeight(), PIXEL_SOLID, FG_BLUE);
+	}
 
-		// DRAW MOUNTAINS
-		// ---------------------------------------------------------
-		// Loop through all transformed, viewed, projected, and sorted triangles
-		for (auto& triToRaster : vecTrianglesToRaster2)
+	// Sort the terrain's clusters into occluders, drawn first, and the rest,
+	// which are tested against hiZ once the occluders are drawn. A cluster is
+	// an occluder if it reaches the near plane, where its box can't be
+	// projected, or if its box covers OCCLUDER_AREA of the screen. Clusters
+	// whose box is wholly outside one side of the view, the near plane
+	// included, are dropped
+	void SortClusters(const std::vector<meshCluster>& clusters, const matRigid& matWorld, const matRigid& matView)
+	{
+		matRigid matWorldView = Matrix_MultiplyMatrix(matWorld, matView);
+		matProjective matWorldToScreen = Matrix_MultiplyMatrix(matWorldView, ProjectionToScreen(true));
+		float fWidth = (float)ScreenWidth(), fHeight = (float)ScreenHeight();
+		float fMinArea = OCCLUDER_AREA * fWidth * fHeight;
+
+		vecClusterTests.clear();
+		vecOccluders.clear();
+		vecClusterNearest.resize(clusters.size());
+		occlusion = {};
+		occlusion.nClusters = (uint32_t)clusters.size();
+		for (uint32_t i = 0; i < (uint32_t)clusters.size(); i++)
 		{
-			// Clip triangles against all four screen edges, this could yield
-			// a bunch of triangles, so create a queue that we traverse to 
-			//  ensure we only test new triangles generated against planes
-			triangle clipped[2];
-			std::list<triangle> listTriangles;
-
-			// Add initial triangle
-			listTriangles.push_back(triToRaster);
-			int nNewTriangles = 1;
-
-			for (int p = 0; p < 4; p++)
+			const meshCluster& c = clusters[i];
+			// Outcodes of the corners against the sides of the screen and the near
+			// plane, in clip space so that corners behind the camera count too
+			int nAllOut = 0x1F;
+			bool bNear = false;
+			float fMinX = 1e30f, fMaxX = -1e30f, fMinY = 1e30f, fMaxY = -1e30f, fNearest = 0.0f;
+			for (int k = 0; k < 8; k++)
 			{
-				int nTrisToAdd = 0;
-				while (nNewTriangles > 0)
+				vec3d p = { k & 1 ? c.vMax.x : c.vMin.x, k & 2 ? c.vMax.y : c.vMin.y, k & 4 ? c.vMax.z : c.vMin.z };
+				p = Matrix_MultiplyVector(matWorldToScreen, p);
+				int nOut = (p.x < 0.0f ? 1 : 0) | (p.x > (fWidth - 1) * p.w ? 2 : 0) |
+					(p.y < 0.0f ? 4 : 0) | (p.y > (fHeight - 1) * p.w ? 8 : 0) | (p.w < 0.1f ? 16 : 0);
+				nAllOut &= nOut;
+				if (p.w < 0.1f)
 				{
-					// Take triangle from front of queue
-					triangle test = listTriangles.front();
-					listTriangles.pop_front();
-					nNewTriangles--;
-
-					// Clip it against a plane. We only need to test each 
-					// subsequent plane, against subsequent new triangles
-					// as all triangles after a plane clip are guaranteed
-					// to lie on the inside of the plane. I like how this
-					// comment is almost completely and utterly justified
-					switch (p)
-					{
-					case 0:	nTrisToAdd = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 1:	nTrisToAdd = Triangle_ClipAgainstPlane({ 0.0f, (float)ScreenHeight() - 1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 2:	nTrisToAdd = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 3:	nTrisToAdd = Triangle_ClipAgainstPlane({ (float)ScreenWidth() - 1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					}
-
-					// Clipping may yield a variable number of triangles, so
-					// add these new ones to the back of the queue for subsequent
-					// clipping against next planes
-					for (int w = 0; w < nTrisToAdd; w++)
-						listTriangles.push_back(clipped[w]);
+					bNear = true;
+					continue;
 				}
-				nNewTriangles = listTriangles.size();
+				float fInvW = 1.0f / p.w;
+				float x = p.x * fInvW, y = p.y * fInvW;
+				if (x < fMinX) fMinX = x;
+				if (x > fMaxX) fMaxX = x;
+				if (y < fMinY) fMinY = y;
+				if (y > fMaxY) fMaxY = y;
+				if (fInvW > fNearest) fNearest = fInvW;
 			}
-			// Draw the triangles
-			for (auto& t : listTriangles)
+			if (nAllOut)
 			{
-				// Rasterize Triangle
-				FillTriangle(
-					t.p[0].x, t.p[0].y,
-					t.p[1].x, t.p[1].y,
-					t.p[2].x, t.p[2].y,
-					t.sym, t.col);
-
-				// Wireframe Triangle (Outline for debugging)
-				if (GetKey(L'1').bHeld) {
-					DrawTriangle(
-						t.p[0].x, t.p[0].y,
-						t.p[1].x, t.p[1].y,
-						t.p[2].x, t.p[2].y,
-						PIXEL_SOLID, FG_BLACK);
-				}
+				occlusion.nOffScreen++;
+				continue;
+			}
+			if (bNear)
+			{
+				vecClusterNearest[i] = 10.0f;	// 1 / w at the near plane
+				vecOccluders.push_back(i);
+				continue;
 			}
+
+			// Triangle corners are rounded to whole cells before drawing, so
+			// allow a cell more all round
+			clusterTest t;
+			t.nCluster = i;
+			t.fNearest = fNearest;
+			t.rc.nLeft = fMinX < 1.0f ? 0 : (int)fMinX - 1;
+			t.rc.nTop = fMinY < 1.0f ? 0 : (int)fMinY - 1;
+			t.rc.nRight = fMaxX > fWidth - 2 ? ScreenWidth() : (int)fMaxX + 2;
+			t.rc.nBottom = fMaxY > fHeight - 2 ? ScreenHeight() : (int)fMaxY + 2;
+			if ((float)(t.rc.nRight - t.rc.nLeft) * (float)(t.rc.nBottom - t.rc.nTop) >= fMinArea)
+			{
+				vecClusterNearest[i] = fNearest;
+				vecOccluders.push_back(i);
+			}
+			else
+				vecClusterTests.push_back(t);
 		}
 
-		// DRAW AIRPLANE
-		// ---------------------------------------------------------
-		// Draw the triangles
-		for (auto& t : vecTrianglesToRaster)
+		sort(vecOccluders.begin(), vecOccluders.end(), [this](uint32_t a, uint32_t b)
+			{
+				return vecClusterNearest[a] > vecClusterNearest[b];
+			});
+		occlusion.nOccluders = (uint32_t)vecOccluders.size();
+	}
+
+	// Keep the clusters waiting in vecClusterTests that hiZ doesn't show to be
+	// hidden, in mesh order. nMeshTris is the number of triangles in the mesh,
+	// the last cluster may be short
+	void CullHiddenClusters(uint32_t nMeshTris)
+	{
+		vecVisibleClusters.clear();
+		for (const clusterTest& t : vecClusterTests)
 		{
-			// Rasterize Triangle
-			FillTriangle(
-				t.p[0].x, t.p[0].y,
-				t.p[1].x, t.p[1].y,
-				t.p[2].x, t.p[2].y,
-				t.sym, t.col);
+			if (hiZ.Hidden(t.rc, t.fNearest))
+			{
+				uint32_t nFirst = t.nCluster * CLUSTER_TRIS;
+				occlusion.nHidden++;
+				occlusion.nHiddenTris += nMeshTris - nFirst < CLUSTER_TRIS ? nMeshTris - nFirst : CLUSTER_TRIS;
+			}
+			else
+				vecVisibleClusters.push_back(t.nCluster);
 		}
 	}
-};
\ No newline at end of file
+
+	// Draw the binned triangles, depth tested, spreading the tiles over
+	// nRasterThreads threads. Each tile's triangles are drawn clipped to it, so
+	// threads never touch the same cells. ProjectMesh has already dropped the
+	// triangles off screen and clipped the ones reaching past the guard band
+	void RasterTiles()
+	{
+		rasterPool.ParallelFor(tiles.Count(), [this](size_t i)
+			{
+				rasterRect rc = tiles.Rect((int)i);
+				for (const triangle* t : tiles.bins[i])
+					RasterTriangle(rc, *t);
+			}, nRasterThreads);
+	}
+
+	void RasterTriangle(const rasterRect& rc, const triangle& t)
+	{
+		// Rasterize Triangle, w of each projected corner holds 1 / w
+		FillTriangleDepth(rc,
+			t.p[0].x, t.p[0].y, t.p[0].w,
+			t.p[1].x, t.p[1].y, t.p[1].w,
+			t.p[2].x, t.p[2].y, t.p[2].w,
+			t.shade);
+	}
+
+	// Wireframe Triangles (Outline for debugging), drawn over the finished frame
+	// on the game thread. Round down rather than towards zero, so corners left
+	// of or above the screen keep their place relative to the ones on it
+	void OutlineTriangles(const std::vector<triangle>& vecTriangles)
+	{
+		for (auto& t : vecTriangles)
+			DrawTriangle(
+				(int)floorf(t.p[0].x), (int)floorf(t.p[0].y),
+				(int)floorf(t.p[1].x), (int)floorf(t.p[1].y),
+				(int)floorf(t.p[2].x), (int)floorf(t.p[2].y),
+				PIXEL_SOLID, FG_BLACK);
+	}
+};
@@ -1,21 +1,27 @@
 #pragma once
-#pragma comment(lib, "winmm.lib")
 
-#ifndef UNICODE
-#error Please enable UNICODE for your compiler! VS: Project Properties -> General -> \
-Character Set -> Use Unicode.
+#ifdef _WIN32
+#include "PlatformWindows.h"
+#else
+#include "PlatformLinux.h"
 #endif
-
-#include <windows.h>
+#include "PlatformHeadless.h"
 
 #include <iostream>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <memory>
+#include <string>
 #include <vector>
-#include <list>
 #include <thread>
 #include <atomic>
-#include <condition_variable>
 #include "colors.h"
+#include "Raster.h"
+#include "Present.h"
 
 
 class hamroGraphics
@@ -26,8 +32,12 @@ public:
 		m_nScreenWidth = 80;
 		m_nScreenHeight = 30;
 
-		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
+		// The console of the system we're built for
+#ifdef _WIN32
+		m_platform.reset(new windowsConsole());
+#else
+		m_platform.reset(new ansiTerminal());
+#endif
 
 		std::memset(m_keyNewState, 0, 256 * sizeof(short));
 		std::memset(m_keyOldState, 0, 256 * sizeof(short));
@@ -38,6 +48,8 @@ public:
 		m_bEnableSound = false;
 
 		m_appName = L"Default";
+
+		ResetPalette();
 	}
 
 	void EnableSound()
@@ -45,84 +57,152 @@ public:
 		m_bEnableSound = true;
 	}
 
+	// Present to p instead of the console of the system we're built for, such as
+	// a headlessScreen. Must be called before CreateConsoleWindow
+	void SetPlatform(consolePlatform* p)
+	{
+		m_platform.reset(p);
+	}
+
+	// Screen of width x height cells, each fontw x fonth pixels. A terminal
+	// can't change its size or font, so there a width or height of 0 takes
+	// the terminal's
 	int CreateConsoleWindow(int width, int height, int fontw, int fonth)
 	{
-		if (m_hConsole == INVALID_HANDLE_VALUE)
-			return Error(L"Bad Handle");
+		if (!m_platform->Create(width, height, fontw, fonth, CloseHandler))
+			return 0;
 
 		m_nScreenWidth = width;
 		m_nScreenHeight = height;
 
-		// Change console visual size to a minimum so ScreenBuffer can shrink
-		// below the actual visual size
-		m_rectWindow = { 0, 0, 1, 1 };
-		SetConsoleWindowInfo(m_hConsole, TRUE, &m_rectWindow);
-
-		// Set the size of the screen buffer
-		COORD coord = { (short)m_nScreenWidth, (short)m_nScreenHeight };
-		if (!SetConsoleScreenBufferSize(m_hConsole, coord))
-			Error(L"SetConsoleScreenBufferSize");
-
-		// Assign screen buffer to the console
-		if (!SetConsoleActiveScreenBuffer(m_hConsole))
-			return Error(L"SetConsoleActiveScreenBuffer");
-
-		// Set the font size now that the screen buffer has been assigned to the console
-		CONSOLE_FONT_INFOEX cfi;
-		cfi.cbSize = sizeof(cfi);
-		cfi.nFont = 0;
-		cfi.dwFontSize.X = fontw;
-		cfi.dwFontSize.Y = fonth;
-		cfi.FontFamily = FF_DONTCARE;
-		cfi.FontWeight = FW_NORMAL;
-
-		wcscpy_s(cfi.FaceName, L"Consolas");
-		if (!SetCurrentConsoleFontEx(m_hConsole, false, &cfi))
-			return Error(L"SetCurrentConsoleFontEx");
-
-		// Get screen buffer info and check the maximum allowed window size. Return
-		// error if exceeded, so user knows their dimensions/fontsize are too large
-		CONSOLE_SCREEN_BUFFER_INFO csbi;
-		if (!GetConsoleScreenBufferInfo(m_hConsole, &csbi))
-			return Error(L"GetConsoleScreenBufferInfo");
-		if (m_nScreenHeight > csbi.dwMaximumWindowSize.Y)
-			return Error(L"Screen Height / Font Height Too Big");
-		if (m_nScreenWidth > csbi.dwMaximumWindowSize.X)
-			return Error(L"Screen Width / Font Width Too Big");
-
-		// Set Physical Console Window Size
-		m_rectWindow = { 0, 0, (short)m_nScreenWidth - 1, (short)m_nScreenHeight - 1 };
-		if (!SetConsoleWindowInfo(m_hConsole, TRUE, &m_rectWindow))
-			return Error(L"SetConsoleWindowInfo");
-
-		// Set flags to allow mouse input		
-		if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT))
-			return Error(L"SetConsoleMode");
-
 		// Allocate memory for screen buffer
 		m_bufScreen = new CHAR_INFO[m_nScreenWidth * m_nScreenHeight];
 		memset(m_bufScreen, 0, sizeof(CHAR_INFO) * m_nScreenWidth * m_nScreenHeight);
-
-		SetConsoleCtrlHandler((PHANDLER_ROUTINE)CloseHandler, TRUE);
+		m_bufShade = new uint8_t[m_nScreenWidth * m_nScreenHeight];
+		Clear(0);
+		m_bufDepth = new float[m_nScreenWidth * m_nScreenHeight];
+		ClearDepth();
+		m_delta.Invalidate();
 		return 1;
 	}
 
+	// Everything draws into m_bufShade, one byte a cell holding an index into
+	// m_palette, and the screen is converted to symbols and colors only once it
+	// is finished (see PresentScreen). The first SHADE_COUNT entries are the
+	// shades of GetShadeColour, and every other symbol and color drawn is given
+	// the next free entry by PaletteIndex. Functions taking a symbol and color
+	// look the entry up once and then draw with it
 	virtual void Draw(int x, int y, short c = 0x2588, short col = 0x000F)
+	{
+		DrawIndex(x, y, PaletteIndex(c, col));
+	}
+
+	void DrawIndex(int x, int y, uint8_t nIndex)
 	{
 		if (x >= 0 && x < m_nScreenWidth && y >= 0 && y < m_nScreenHeight)
-		{
-			m_bufScreen[y * m_nScreenWidth + x].Char.UnicodeChar = c;
-			m_bufScreen[y * m_nScreenWidth + x].Attributes = col;
-		}
+			m_bufShade[y * m_nScreenWidth + x] = nIndex;
+	}
+
+	// Cells x1 to x2 of row y, which must all be on screen
+	void FillSpan(int x1, int x2, int y, uint8_t nIndex)
+	{
+		memset(&m_bufShade[y * m_nScreenWidth + x1], nIndex, x2 - x1 + 1);
+	}
+
+	// Set every cell of the screen to palette entry nIndex
+	void Clear(uint8_t nIndex)
+	{
+		memset(m_bufShade, nIndex, m_nScreenWidth * m_nScreenHeight);
 	}
 
 	void Fill(int x1, int y1, int x2, int y2, short c = 0x2588, short col = 0x000F)
 	{
 		Clip(x1, y1);
 		Clip(x2, y2);
-		for (int x = x1; x < x2; x++)
-			for (int y = y1; y < y2; y++)
-				Draw(x, y, c, col);
+		if (x1 >= x2)
+			return;
+		uint8_t nIndex = PaletteIndex(c, col);
+		for (int y = y1; y < y2; y++)
+			FillSpan(x1, x2 - 1, y, nIndex);
+	}
+
+	// Palette entry for symbol c in color col, added if there isn't one yet.
+	// Only the game thread may call this. Entries are found through a hash
+	// table, so looking one up costs the same however many there are. There
+	// is room for 256. Once they are all used, the palette starts again at
+	// the beginning of the next frame. Until then anything new is drawn with
+	// the last entry, because redefining an entry would change cells already
+	// drawn with it
+	uint8_t PaletteIndex(short c, short col)
+	{
+		int nSlot = PaletteSlot(c, col);
+		if (m_paletteHash[nSlot] >= 0)
+			return (uint8_t)m_paletteHash[nSlot];
+		if (m_nPaletteUsed == 256)
+			return 255;
+
+		int i = m_nPaletteUsed++;
+		m_palette[i].Char.UnicodeChar = c;
+		m_palette[i].Attributes = col;
+		m_paletteHash[nSlot] = (int16_t)i;
+		return (uint8_t)i;
+	}
+
+	// Back to just the shades, which come first at their own numbers
+	void ResetPalette()
+	{
+		std::memset(m_palette, 0, sizeof(m_palette));
+		std::memset(m_paletteHash, -1, sizeof(m_paletteHash));
+		m_nPaletteUsed = 0;
+		for (int i = 0; i < SHADE_COUNT; i++)
+		{
+			CHAR_INFO shade = GetShadeColour(i);
+			m_palette[i] = shade;
+			int nSlot = PaletteSlot(shade.Char.UnicodeChar, shade.Attributes);
+			if (m_paletteHash[nSlot] < 0)
+				m_paletteHash[nSlot] = (int16_t)i;
+		}
+		m_nPaletteUsed = SHADE_COUNT;
+	}
+
+	// Slot of m_paletteHash holding symbol c in color col, or the empty one
+	// where it would go
+	int PaletteSlot(short c, short col) const
+	{
+		uint32_t nKey = ((uint32_t)(uint16_t)c << 16) | (uint16_t)col;
+		int nSlot = (int)((nKey * 2654435761u) >> (32 - PALETTE_HASH_BITS));
+		while (m_paletteHash[nSlot] >= 0)
+		{
+			const CHAR_INFO& entry = m_palette[m_paletteHash[nSlot]];
+			if (entry.Char.UnicodeChar == (wchar_t)c && entry.Attributes == (unsigned short)col)
+				break;
+			nSlot = (nSlot + 1) & ((1 << PALETTE_HASH_BITS) - 1);
+		}
+		return nSlot;
+	}
+
+	// Write the finished frame to the console. Only the cells that differ from
+	// the frame presented before are looked up in the palette and handed to
+	// the platform (see frameDelta)
+	void PresentScreen()
+	{
+		if (!m_platform->WantsFrames())
+			return;
+		m_delta.Diff(m_bufShade, m_nScreenWidth, m_nScreenHeight, m_vecDirtyRuns);
+		for (auto& run : m_vecDirtyRuns)
+		{
+			int nRow = run.y * m_nScreenWidth;
+			for (int x = run.x1; x <= run.x2; x++)
+				m_bufScreen[nRow + x] = m_palette[m_bufShade[nRow + x]];
+		}
+
+		m_platform->Present(m_bufScreen, m_nScreenWidth, m_nScreenHeight, m_vecDirtyRuns);
+	}
+
+	// Mark every cell as empty for the depth tested FillTriangle
+	void ClearDepth()
+	{
+		memset(m_bufDepth, 0, sizeof(float) * m_nScreenWidth * m_nScreenHeight);
 	}
 
 	void Clip(int& x, int& y)
@@ -136,6 +216,7 @@ public:
 	// BRESENHAM LINE DRAWING ALGORITHM
 	void DrawLine(int x1, int y1, int x2, int y2, short c = 0x2588, short col = 0x000F)
 	{
+		uint8_t nIndex = PaletteIndex(c, col);
 		int x, y, dx, dy, xinc, yinc, p, i;
 		x = x1; y = y1;
 		dx = abs(x2 - x1); dy = abs(y2 - y1);
@@ -143,7 +224,7 @@ public:
 		yinc = (y2 > y1) ? 1 : - 1;
 		if (dx >= dy)
 		{
-			Draw(x, y, c, col);
+			DrawIndex(x, y, nIndex);
 			p = 2 * dy - dx;
 			for (i = 0; i < dx; i++)
 			{
@@ -155,12 +236,12 @@ public:
 					p = p + 2 * dy - 2 * dx;
 					y = y + yinc;
 				}
-				Draw(x, y, c, col);
+				DrawIndex(x, y, nIndex);
 			}
 		}
 		else 
 		{
-			Draw(x, y, c, col);
+			DrawIndex(x, y, nIndex);
 			p = 2 * dx - dy;
 			for (i = 0; i < dy; i++)
 			{
@@ -172,7 +253,7 @@ public:
 					p = p + 2 * dx - 2 * dy;
 					x = x + xinc;
 				}
-				Draw(x, y, c, col);
+				DrawIndex(x, y, nIndex);
 			}
 		}
 	}
@@ -186,148 +267,99 @@ public:
 		DrawLine(x3, y3, x1, y1, c, col);
 	}
 
-	// https://www.avrfreaks.net/sites/default/files/triangles.c
 	void FillTriangle(int x1, int y1, int x2, int y2, int x3, int y3, short c = 0x2588, short col = 0x000F)
 	{
-		auto SWAP = [](int& x, int& y) { int t = x; x = y; y = t; };
-		auto drawline = [&](int sx, int ex, int ny) { for (int i = sx; i <= ex; i++) Draw(i, ny, c, col); };
-
-		int t1x, t2x, y, minx, maxx, t1xp, t2xp;
-		bool changed1 = false;
-		bool changed2 = false;
-		int signx1, signx2, dx1, dy1, dx2, dy2;
-		int e1, e2;
-		// Sort vertices
-		if (y1 > y2) { SWAP(y1, y2); SWAP(x1, x2); }
-		if (y1 > y3) { SWAP(y1, y3); SWAP(x1, x3); }
-		if (y2 > y3) { SWAP(y2, y3); SWAP(x2, x3); }
-
-		t1x = t2x = x1; y = y1;   // Starting points
-		dx1 = (int)(x2 - x1); if (dx1 < 0) { dx1 = -dx1; signx1 = -1; }
-		else signx1 = 1;
-		dy1 = (int)(y2 - y1);
-
-		dx2 = (int)(x3 - x1); if (dx2 < 0) { dx2 = -dx2; signx2 = -1; }
-		else signx2 = 1;
-		dy2 = (int)(y3 - y1);
-
-		if (dy1 > dx1) {   // swap values
-			SWAP(dx1, dy1);
-			changed1 = true;
-		}
-		if (dy2 > dx2) {   // swap values
-			SWAP(dy2, dx2);
-			changed2 = true;
+		uint8_t nIndex = PaletteIndex(c, col);
+		Raster_ScanTriangle(m_nScreenWidth, m_nScreenHeight, x1, y1, x2, y2, x3, y3, [&](int sx, int ex, int ny)
+			{
+				FillSpan(sx, ex, ny, nIndex);
+			});
+	}
+
+	// Same, but depth tested against m_bufDepth. z1, z2 and z3 are 1 / w at the
+	// corners, so larger is nearer. 1 / w is linear across the screen, so it is
+	// worked out as a plane through the corners and stepped along each span, and
+	// a cell is drawn only where the triangle is nearer than what is already there.
+	// The triangle is drawn with palette entry nIndex (see PaletteIndex)
+	void FillTriangle(int x1, int y1, float z1, int x2, int y2, float z2, int x3, int y3, float z3, uint8_t nIndex)
+	{
+		FillTriangle(ScreenRect(), x1, y1, z1, x2, y2, z2, x3, y3, z3, nIndex);
+	}
+
+	// Same, drawing only the cells inside rcClip
+	void FillTriangle(const rasterRect& rcClip, int x1, int y1, float z1, int x2, int y2, float z2, int x3, int y3, float z3, uint8_t nIndex)
+	{
+		// Stepping a plane through rounded corners can overshoot near the edges
+		// of thin triangles, so keep the depth between the corners' own
+		float fMinZ = z1 < z2 ? z1 : z2; if (z3 < fMinZ) fMinZ = z3;
+		float fMaxZ = z1 > z2 ? z1 : z2; if (z3 > fMaxZ) fMaxZ = z3;
+		float fDzDx = 0.0f, fDzDy = 0.0f;
+		int nDet = (x2 - x1) * (y3 - y1) - (x3 - x1) * (y2 - y1);
+		if (nDet != 0)
+		{
+			float fInvDet = 1.0f / (float)nDet;
+			fDzDx = ((z2 - z1) * (y3 - y1) - (z3 - z1) * (y2 - y1)) * fInvDet;
+			fDzDy = ((z3 - z1) * (x2 - x1) - (z2 - z1) * (x3 - x1)) * fInvDet;
 		}
 
-		e2 = (int)(dx2 >> 1);
-		// Flat top, just process the second half
-		if (y1 == y2) goto next;
-		e1 = (int)(dx1 >> 1);
-
-		for (int i = 0; i < dx1;) {
-			t1xp = 0; t2xp = 0;
-			if (t1x < t2x) { minx = t1x; maxx = t2x; }
-			else { minx = t2x; maxx = t1x; }
-			// process first line until y value is about to change
-			while (i < dx1) {
-				i++;
-				e1 += dy1;
-				while (e1 >= dx1) {
-					e1 -= dx1;
-					if (changed1) t1xp = signx1;//t1x += signx1;
-					else          goto next1;
-				}
-				if (changed1) break;
-				else t1x += signx1;
-			}
-			// Move line
-		next1:
-			// process second line until y value is about to change
-			while (1) {
-				e2 += dy2;
-				while (e2 >= dx2) {
-					e2 -= dx2;
-					if (changed2) t2xp = signx2;//t2x += signx2;
-					else          goto next2;
+		Raster_ScanTriangle(rcClip, x1, y1, x2, y2, x3, y3, [&](int sx, int ex, int ny)
+			{
+				float* pDepth = &m_bufDepth[ny * m_nScreenWidth];
+				uint8_t* pShade = &m_bufShade[ny * m_nScreenWidth];
+				float z = z1 + fDzDx * (float)(sx - x1) + fDzDy * (float)(ny - y1);
+				for (int i = sx; i <= ex; i++, z += fDzDx)
+				{
+					float zCell = z < fMinZ ? fMinZ : (z > fMaxZ ? fMaxZ : z);
+					if (zCell > pDepth[i])
+					{
+						pDepth[i] = zCell;
+						pShade[i] = nIndex;
+					}
 				}
-				if (changed2)     break;
-				else              t2x += signx2;
-			}
-		next2:
-			if (minx > t1x) minx = t1x; if (minx > t2x) minx = t2x;
-			if (maxx < t1x) maxx = t1x; if (maxx < t2x) maxx = t2x;
-			drawline(minx, maxx, y);    // Draw line from min to max points found on the y
-										 // Now increase y
-			if (!changed1) t1x += signx1;
-			t1x += t1xp;
-			if (!changed2) t2x += signx2;
-			t2x += t2xp;
-			y += 1;
-			if (y == y2) break;
+			});
+	}
 
+	// Rasterizers FillTriangleDepth can use
+	enum RASTERIZER { RASTER_SCANLINE, RASTER_HALFSPACE };
+
+	// Depth tested triangle with corners given in cells, fractions included, and
+	// 1 / w at each, drawn with palette entry nIndex. RASTER_SCANLINE rounds the
+	// corners down to whole cells like FillTriangle. RASTER_HALFSPACE keeps 1/16
+	// of a cell (see Raster_HalfSpaceTriangle)
+	void FillTriangleDepth(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3, uint8_t nIndex)
+	{
+		FillTriangleDepth(ScreenRect(), x1, y1, z1, x2, y2, z2, x3, y3, z3, nIndex);
+	}
+
+	// Same, drawing only the cells inside rcClip. Nothing outside it is read or
+	// written, so triangles can be drawn into separate parts of the screen on
+	// separate threads
+	void FillTriangleDepth(const rasterRect& rcClip, float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3, uint8_t nIndex)
+	{
+		if (m_rasterizer == RASTER_HALFSPACE)
+		{
+			rasterTarget<uint8_t> target = { m_bufShade, m_bufDepth, m_nScreenWidth, m_nScreenHeight };
+			Raster_HalfSpaceTriangle(target, rcClip, x1, y1, z1, x2, y2, z2, x3, y3, z3, nIndex);
 		}
-	next:
-		// Second half
-		dx1 = (int)(x3 - x2); if (dx1 < 0) { dx1 = -dx1; signx1 = -1; }
-		else signx1 = 1;
-		dy1 = (int)(y3 - y2);
-		t1x = x2;
-
-		if (dy1 > dx1) {   // swap values
-			SWAP(dy1, dx1);
-			changed1 = true;
-		}
-		else changed1 = false;
-
-		e1 = (int)(dx1 >> 1);
-
-		for (int i = 0; i <= dx1; i++) {
-			t1xp = 0; t2xp = 0;
-			if (t1x < t2x) { minx = t1x; maxx = t2x; }
-			else { minx = t2x; maxx = t1x; }
-			// process first line until y value is about to change
-			while (i < dx1) {
-				e1 += dy1;
-				while (e1 >= dx1) {
-					e1 -= dx1;
-					if (changed1) { t1xp = signx1; break; }//t1x += signx1;
-					else          goto next3;
-				}
-				if (changed1) break;
-				else   	   	  t1x += signx1;
-				if (i < dx1) i++;
-			}
-		next3:
-			// process second line until y value is about to change
-			while (t2x != x3) {
-				e2 += dy2;
-				while (e2 >= dx2) {
-					e2 -= dx2;
-					if (changed2) t2xp = signx2;
-					else          goto next4;
-				}
-				if (changed2)     break;
-				else              t2x += signx2;
-			}
-		next4:
-
-			if (minx > t1x) minx = t1x; if (minx > t2x) minx = t2x;
-			if (maxx < t1x) maxx = t1x; if (maxx < t2x) maxx = t2x;
-			drawline(minx, maxx, y);
-			if (!changed1) t1x += signx1;
-			t1x += t1xp;
-			if (!changed2) t2x += signx2;
-			t2x += t2xp;
-			y += 1;
-			if (y > y3) return;
+		else
+		{
+			FillTriangle(rcClip, (int)floorf(x1), (int)floorf(y1), z1, (int)floorf(x2), (int)floorf(y2), z2,
+				(int)floorf(x3), (int)floorf(y3), z3, nIndex);
 		}
 	}
 
-	~hamroGraphics()
+	// Every cell of the screen
+	rasterRect ScreenRect()
 	{
-		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
+		return { 0, 0, m_nScreenWidth, m_nScreenHeight };
+	}
+
+	virtual ~hamroGraphics()
+	{
+		m_platform->Restore();
 		delete[] m_bufScreen;
+		delete[] m_bufShade;
+		delete[] m_bufDepth;
 	}
 
 public:
@@ -371,12 +403,13 @@ private:
 				tp2 = std::chrono::system_clock::now();
 				std::chrono::duration<float> elapsedTime = tp2 - tp1;
 				tp1 = tp2;
-				float fElapsedTime = elapsedTime.count();
+				float fElapsedTime = m_platform->FrameTime(elapsedTime.count());
 
 				// Handle Keyboard Input
+				m_platform->ReadInput(m_input);
 				for (int i = 0; i < 256; i++)
 				{
-					m_keyNewState[i] = GetAsyncKeyState(i);
+					m_keyNewState[i] = m_input.bKeys[i] ? (short)0x8000 : 0;
 
 					m_keys[i].bPressed = false;
 					m_keys[i].bReleased = false;
@@ -398,54 +431,16 @@ private:
 					m_keyOldState[i] = m_keyNewState[i];
 				}
 
-				// Handle Mouse Input - Check for window events
-				INPUT_RECORD inBuf[32];
-				DWORD events = 0;
-				GetNumberOfConsoleInputEvents(m_hConsoleIn, &events);
-				if (events > 0)
-					ReadConsoleInput(m_hConsoleIn, inBuf, events, &events);
-
-				// Handle events - we only care about mouse clicks and movement
-				// for now
-				for (DWORD i = 0; i < events; i++)
+				// Handle Mouse Input and window events
+				m_mousePosX = m_input.nMouseX;
+				m_mousePosY = m_input.nMouseY;
+				for (int m = 0; m < 5; m++)
+					m_mouseNewState[m] = m_input.bMouse[m];
+				m_bConsoleInFocus = m_input.bFocused;
+				if (m_input.bRedraw)
 				{
-					switch (inBuf[i].EventType)
-					{
-					case FOCUS_EVENT:
-					{
-						m_bConsoleInFocus = inBuf[i].Event.FocusEvent.bSetFocus;
-					}
-					break;
-
-					case MOUSE_EVENT:
-					{
-						switch (inBuf[i].Event.MouseEvent.dwEventFlags)
-						{
-						case MOUSE_MOVED:
-						{
-							m_mousePosX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
-							m_mousePosY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
-						}
-						break;
-
-						case 0:
-						{
-							for (int m = 0; m < 5; m++)
-								m_mouseNewState[m] = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) > 0;
-
-						}
-						break;
-
-						default:
-							break;
-						}
-					}
-					break;
-
-					default:
-						break;
-						// We don't care just at the moment
-					}
+					m_delta.Invalidate();
+					m_input.bRedraw = false;
 				}
 
 				for (int m = 0; m < 5; m++)
@@ -471,15 +466,23 @@ private:
 				}
 
 
+				// A full palette starts again, and since entry numbers may now
+				// stand for something else the whole frame is presented
+				if (m_nPaletteUsed == 256)
+				{
+					ResetPalette();
+					m_delta.Invalidate();
+				}
+
 				// Handle Frame Update
 				if (!OnUserUpdate(fElapsedTime))
 					m_bAtomActive = false;
 
 				// Update Title & Present Screen Buffer
 				wchar_t s[256];
-				swprintf_s(s, 256, L"Graphics - Console Model Rendering - %s - FPS: %3.2f", m_appName.c_str(), 1.0f / fElapsedTime);
-				SetConsoleTitle(s);
-				WriteConsoleOutput(m_hConsole, m_bufScreen, { (short)m_nScreenWidth, (short)m_nScreenHeight }, { 0,0 }, &m_rectWindow);
+				swprintf(s, 256, L"Graphics - Console Model Rendering - %ls - FPS: %3.2f", m_appName.c_str(), 1.0f / fElapsedTime);
+				m_platform->SetTitle(s);
+				PresentScreen();
 			}
 
 			if (m_bEnableSound)
@@ -492,8 +495,12 @@ private:
 			{
 				// User has permitted destroy, so exit and clean up
 				delete[] m_bufScreen;
-				SetConsoleActiveScreenBuffer(m_hOriginalConsole);
-				m_cvGameFinished.notify_one();
+				delete[] m_bufShade;
+				delete[] m_bufDepth;
+				m_bufScreen = nullptr;
+				m_bufShade = nullptr;
+				m_bufDepth = nullptr;
+				m_platform->Restore();
 			}
 			else
 			{
@@ -533,41 +540,29 @@ public:
 
 
 protected:
-	int Error(const wchar_t* msg)
-	{
-		wchar_t buf[256];
-		FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, 256, NULL);
-		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
-		wprintf(L"ERROR: %s\n\t%s\n", msg, buf);
-		return 0;
-	}
-
-	static BOOL CloseHandler(DWORD evt)
+	// Called by the platform when the console is closed, perhaps on another
+	// thread or in a signal handler, so it only asks the game thread to stop
+	static void CloseHandler()
 	{
-		// Note this gets called in a seperate OS thread, so it must
-		// only exit when the game has finished cleaning up, or else
-		// the process will be killed before OnUserDestroy() has finished
-		if (evt == CTRL_CLOSE_EVENT)
-		{
-			m_bAtomActive = false;
-
-			// Wait for thread to be exited
-			std::unique_lock<std::mutex> ul(m_muxGame);
-			m_cvGameFinished.wait(ul);
-		}
-		return true;
+		m_bAtomActive = false;
 	}
 
 protected:
 	int m_nScreenWidth;
 	int m_nScreenHeight;
-	CHAR_INFO* m_bufScreen;
+	CHAR_INFO* m_bufScreen = nullptr;	// The frame as presented, filled in by PresentScreen
+	uint8_t* m_bufShade = nullptr;	// Palette entry of each cell, what everything draws into
+	float* m_bufDepth = nullptr;	// 1 / w of what is drawn in each cell, 0 where nothing is
+	CHAR_INFO m_palette[256];	// What each palette entry looks like
+	int m_nPaletteUsed = SHADE_COUNT;
+	static const int PALETTE_HASH_BITS = 9;	// Twice as many slots as entries, so probes stay short
+	int16_t m_paletteHash[1 << PALETTE_HASH_BITS];	// Palette entry in each slot, -1 if empty
+	frameDelta m_delta;	// Last frame presented
+	std::vector<dirtyRun> m_vecDirtyRuns;
+	RASTERIZER m_rasterizer = RASTER_SCANLINE;	// Used by FillTriangleDepth
 	std::wstring m_appName;
-	HANDLE m_hOriginalConsole;
-	CONSOLE_SCREEN_BUFFER_INFO m_OriginalConsoleInfo;
-	HANDLE m_hConsole;
-	HANDLE m_hConsoleIn;
-	SMALL_RECT m_rectWindow;
+	std::unique_ptr<consolePlatform> m_platform;	// Where frames are presented and input comes from
+	platformInput m_input;
 	short m_keyOldState[256] = { 0 };
 	short m_keyNewState[256] = { 0 };
 	bool m_mouseOldState[5] = { 0 };
@@ -575,14 +570,10 @@ protected:
 	bool m_bConsoleInFocus = true;
 	bool m_bEnableSound = false;
 
-	// These need to be static because of the OnDestroy call the OS may make. The OS
+	// This needs to be static because of the OnDestroy call the OS may make. The OS
 	// spawns a special thread just for that
 	static std::atomic<bool> m_bAtomActive;
-	static std::condition_variable m_cvGameFinished;
-	static std::mutex m_muxGame;
 };
 
 // Define our static variables
-std::atomic<bool> hamroGraphics::m_bAtomActive(false);
-std::condition_variable hamroGraphics::m_cvGameFinished;
-std::mutex hamroGraphics::m_muxGame;
\ No newline at end of file
+std::atomic<bool> hamroGraphics::m_bAtomActive(false);
\ No newline at end of file
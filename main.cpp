@@ -1,12 +1,71 @@
 #include "headers/hamroEngine.h"
 
-int main() {
+int main(int argc, char* argv[]) {
 	hamroEngine3D demo;
 
+	// Options start the program with what the keys switch already switched,
+	// which is the only way to get at them with --headless:
+	//   --mode mountains	the airplane over the mountains (M)
+	//   --halfspace		the half-space rasterizer (H)
+	//   --threads N		tiles drawn by N threads (T)
+	//   --no-occlusion	no occlusion culling of the mountains (O)
+	//   --front-to-back	triangles sorted nearest first (F)
+	//   --fly		the camera flown low through the mountains on a fixed path
+	std::vector<const char*> args;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "mountains") == 0)
+				demo.ShowMountains();
+			else if (strcmp(argv[i], "airplane") != 0)
+			{
+				fprintf(stderr, "ERROR: --mode is airplane or mountains\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--halfspace") == 0)
+			demo.UseHalfSpace();
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			demo.SetRasterThreads((unsigned)atoi(argv[++i]));
+		else if (strcmp(argv[i], "--no-occlusion") == 0)
+			demo.SetOcclusion(false);
+		else if (strcmp(argv[i], "--front-to-back") == 0)
+			demo.SetFrontToBack(true);
+		else if (strcmp(argv[i], "--fly") == 0)
+			demo.FlyThrough();
+		else
+			args.push_back(argv[i]);
+	}
+
+	// hamro --headless width height [frames] [image pattern] draws with no
+	// console, for timing the engine alone or comparing images (see headlessScreen).
+	// The models are loaded first so that every run draws the same frames
+	if (args.size() >= 3 && strcmp(args[0], "--headless") == 0)
+	{
+		if (args.size() > 4 && !headlessScreen::ValidImagePattern(args[4]))
+		{
+			fprintf(stderr, "ERROR: The image pattern needs one %%d for the frame number, and no other %% but %%%%\n");
+			return 1;
+		}
+		demo.LoadModelsFirst();
+		demo.SetPlatform(new headlessScreen(args.size() > 3 ? atoi(args[3]) : 0, args.size() > 4 ? args[4] : ""));
+		if (!demo.CreateConsoleWindow(atoi(args[1]), atoi(args[2]), 1, 1))
+			return 1;
+		demo.Start();
+		return 0;
+	}
+
+#ifdef _WIN32
 	// Create console window of (800 character wide, 450 character height, each pixel of 1x1)
 	if (demo.CreateConsoleWindow(800, 450, 1, 1))
 	//if (demo.CreateConsoleWindow(200, 150, 4, 4))
 	//if (demo.CreateConsoleWindow(400, 250, 2, 2))	// For better FPS, but worse graphics
+#else
+	// A terminal keeps its own size and font, so fill it
+	if (demo.CreateConsoleWindow(0, 0, 1, 1))
+#endif
 		demo.Start();
 	else
 		throw("Can't create console window.");
@@ -0,0 +1,176 @@
+// Throughput of the Vector and Matrix helpers, in millions of calls a second.
+// Build it twice to compare the SSE and plain C++ versions:
+//
+//   g++ -O2 tools/mathbench.cpp -o mathbench
+//   g++ -O2 -DHAMRO_NO_SIMD tools/mathbench.cpp -o mathbench_scalar
+//
+//   cl /O2 /EHsc tools\mathbench.cpp
+//   cl /O2 /EHsc /DHAMRO_NO_SIMD tools\mathbench.cpp /Femathbench_scalar.exe
+
+#include "../headers/Matrix.h"
+#include "../headers/Transform.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+
+// The helpers are protected members, so the benchmark derives from them
+class MathBench : private Matrix
+{
+public:
+	MathBench()
+	{
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+		for (auto& v : vecs)
+			v = { dist(rng), dist(rng), dist(rng), 1.0f };
+		for (auto& m : mats)
+			for (auto& row : m.m)
+				for (float& f : row)
+					f = dist(rng);
+		for (int i = 0; i < N_MATS; i++)
+		{
+			// Same entries with the last column of an affine matrix
+			affs[i] = matAffine(mats[i]);
+			affs[i].m[0][3] = affs[i].m[1][3] = affs[i].m[2][3] = 0.0f;
+			affs[i].m[3][3] = 1.0f;
+		}
+		for (int i = 0; i < N_VECS; i++)
+		{
+			xs[i] = vecs[i].x;
+			ys[i] = vecs[i].y;
+			zs[i] = vecs[i].z;
+		}
+		screen.Resize(N_VECS);
+	}
+
+	void Run()
+	{
+		std::cout << "Vector/Matrix helpers, " << (HAMRO_SIMD ? "SSE matrix helpers" : "plain C++ only")
+			<< (HAMRO_RSQRT ? ", fast reciprocal square root" : "") << "\n";
+
+		Time("Vector_Add", [&](int i) { return Vector_Add(vecs[i], vecs[i + 1]); });
+		Time("Vector_Sub", [&](int i) { return Vector_Sub(vecs[i], vecs[i + 1]); });
+		Time("Vector_Multiply", [&](int i) { return Vector_Multiply(vecs[i], vecs[i + 1].x); });
+		Time("Vector_Divide", [&](int i) { return Vector_Divide(vecs[i], vecs[i + 1].x); });
+		Time("Vector_DotProduct", [&](int i) { return vec3d{ Vector_DotProduct(vecs[i], vecs[i + 1]) }; });
+		Time("Vector_Length", [&](int i) { return vec3d{ Vector_Length(vecs[i]) }; });
+		Time("Vector_InvSqrt", [&](int i) { return vec3d{ Vector_InvSqrt(vecs[i].x * vecs[i].x + 1.0f) }; });
+		Time("Vector_Normalise", [&](int i) { return Vector_Normalise(vecs[i]); });
+		Time("Vector_CrossProduct", [&](int i) { return Vector_CrossProduct(vecs[i], vecs[i + 1]); });
+		Time("Matrix_MultiplyVector", [&](int i) { return Matrix_MultiplyVector(mats[i % N_MATS], vecs[i]); });
+		Time("Matrix_MultiplyMatrix", [&](int i)
+			{
+				mat4x4 m = Matrix_MultiplyMatrix(mats[i % N_MATS], mats[(i + 1) % N_MATS]);
+				return Columns(m);
+			});
+		Time("Matrix_MultiplyMatrix (affine)", [&](int i)
+			{
+				matAffine m = Matrix_MultiplyMatrix(affs[i % N_MATS], affs[(i + 1) % N_MATS]);
+				return Columns(m);
+			});
+		Time("Matrix_Inverse (affine)", [&](int i)
+			{
+				matAffine m = Matrix_Inverse(affs[i % N_MATS]);
+				return Columns(m);
+			});
+		Time("Matrix_Inverse (projective)", [&](int i)
+			{
+				matProjective m = Matrix_Inverse(matProjective(mats[i % N_MATS]));
+				return Columns(m);
+			});
+
+		// Whole streams at once, counted per vertex. The batch call is made once
+		// for every N_VECS calls of fn, so it is timed as a whole array at i == 0
+		Time("Transform_Batch", [&](int i)
+			{
+				if (i == 0)
+					Transform_Batch(mats[0], xs, ys, zs, N_VECS, screen);
+				return vec3d{ screen.x[i] };
+			});
+
+		InvSqrtError();
+	}
+
+	// Largest relative error of Vector_InvSqrt over every float in [1, 4). The
+	// estimate depends only on the mantissa and whether the exponent is odd or
+	// even, so this range covers every case
+	void InvSqrtError()
+	{
+		double fWorst = 0.0;
+		float fWorstAt = 0.0f;
+		for (uint32_t bits = 0x3f800000; bits < 0x40800000; bits++)
+		{
+			float f;
+			memcpy(&f, &bits, sizeof(f));
+			double exact = 1.0 / sqrt((double)f);
+			double err = fabs(Vector_InvSqrt(f) - exact) / exact;
+			if (err > fWorst)
+			{
+				fWorst = err;
+				fWorstAt = f;
+			}
+		}
+		std::cout << "Vector_InvSqrt worst relative error " << std::scientific << std::setprecision(2) << fWorst
+			<< " at " << std::setprecision(9) << fWorstAt << std::fixed << "\n";
+	}
+
+private:
+	static const int N_VECS = 4096;	// Small enough to stay in L1
+	static const int N_MATS = 256;
+	static const int N_PASSES = 2000;
+
+	vec3d vecs[N_VECS + 1];
+	mat4x4 mats[N_MATS];
+	matAffine affs[N_MATS];
+	vec3d results[N_VECS];
+	float xs[N_VECS], ys[N_VECS], zs[N_VECS];
+	screenVerts screen;
+	volatile float m_fSink = 0.0f;
+
+	// Sum of each column, so every entry of a matrix result is used and none of
+	// the work can be left out
+	static vec3d Columns(const mat4x4& m)
+	{
+		vec3d v;
+		v.x = m.m[0][0] + m.m[1][0] + m.m[2][0] + m.m[3][0];
+		v.y = m.m[0][1] + m.m[1][1] + m.m[2][1] + m.m[3][1];
+		v.z = m.m[0][2] + m.m[1][2] + m.m[2][2] + m.m[3][2];
+		v.w = m.m[0][3] + m.m[1][3] + m.m[2][3] + m.m[3][3];
+		return v;
+	}
+
+	// Call fn over the whole array many times, storing the results so the calls
+	// can't be dropped. Best of a few runs, to keep other load out of the numbers
+	template<class F>
+	void Time(const char* name, F fn)
+	{
+		double fBest = 1e30;
+		for (int run = 0; run < 5; run++)
+		{
+			auto tStart = std::chrono::steady_clock::now();
+			for (int pass = 0; pass < N_PASSES / 5; pass++)
+			{
+				for (int i = 0; i < N_VECS; i++)
+					results[i] = fn(i);
+				m_fSink = results[pass % N_VECS].x;
+			}
+			auto tEnd = std::chrono::steady_clock::now();
+			double seconds = std::chrono::duration<double>(tEnd - tStart).count();
+			if (seconds < fBest)
+				fBest = seconds;
+		}
+
+		double mops = (double)(N_PASSES / 5) * N_VECS / fBest / 1e6;
+		std::cout << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(8) << mops << " M/s\n";
+	}
+};
+
+int main()
+{
+	static MathBench bench;	// Too big for the stack
+	bench.Run();
+	return 0;
+}
@@ -0,0 +1,59 @@
+// Offline converter from Wavefront OBJ files to the baked .mesh cache format
+// that mesh::Load maps at startup. Writes <name>.mesh next to every <name>.obj
+//
+//   meshbake resources/*.obj
+//
+// Build: cl /O2 /EHsc tools\meshbake.cpp    or    g++ -O2 tools/meshbake.cpp -o meshbake
+
+#include "../headers/MeshPacked.h"
+
+#include <iostream>
+#include <iomanip>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: meshbake file.obj [file.obj ...]\n";
+		return 1;
+	}
+
+	int failed = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string source = argv[i];
+		std::string cache = mesh::CacheFileName(source);
+
+		uint64_t sourceSize, sourceTime;
+		mesh m;
+		float fBeforeACMR;
+		if (!GetFileStamp(source, sourceSize, sourceTime) || !m.LoadFromObjectFile(source, nullptr, &fBeforeACMR))
+		{
+			std::cout << source << ": couldn't load object\n";
+			failed++;
+			continue;
+		}
+
+		if (!m.SaveToCacheFile(cache, sourceSize, sourceTime))
+		{
+			std::cout << cache << ": couldn't write cache\n";
+			failed++;
+			continue;
+		}
+
+		std::cout << source << " -> " << cache << " (" << m.nVerts << " vertices, " << m.nTris << " triangles)\n";
+
+		// Vertex cache misses per triangle in file order and as baked
+		std::vector<uint32_t> indices(m.pIndices, m.pIndices + 3 * (size_t)m.nTris);
+		std::cout << std::fixed << std::setprecision(3) << "  ACMR " << fBeforeACMR << " in file order, "
+			<< Mesh_CacheMissRatio(indices) << " optimized\n";
+
+		// What HAMRO_PACKED_MESHES would keep in memory instead
+		meshPacked packed;
+		Mesh_Pack(m, packed);
+		std::cout << "  " << m.Bytes() << " bytes as floats, " << packed.Bytes() << " packed ("
+			<< std::setprecision(1) << (double)m.Bytes() / (double)packed.Bytes() << "x smaller)\n";
+	}
+
+	return failed ? 1 : 0;
+}
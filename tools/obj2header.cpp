@@ -0,0 +1,169 @@
+// Converts a Wavefront OBJ file and its levels of detail to a header of constexpr
+// arrays, for builds with HAMRO_EMBEDDED_MESHES that link their models into the
+// program instead of loading them at startup
+//
+//   obj2header resources/airbus.obj headers/embedded/airbus.h
+//
+// The header defines embedded::<name> (an embeddedModel), where <name> is the
+// object file's name without its extension. Directories on the way to the
+// header are created if they are missing.
+//
+// Build: cl /O2 /EHsc tools\obj2header.cpp    or    g++ -O2 tools/obj2header.cpp -o obj2header -lpthread
+
+#include "../headers/MeshSimplify.h"
+
+#include <iostream>
+#include <cctype>
+#include <cmath>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Create every directory leading up to the file, ignoring those that exist
+static void MakeParentDirectories(const std::string& filename)
+{
+	for (size_t slash = filename.find_first_of("/\\", 1); slash != std::string::npos; slash = filename.find_first_of("/\\", slash + 1))
+	{
+		std::string dir = filename.substr(0, slash);
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0755);
+#endif
+	}
+}
+
+// Index of the first vertex with an infinite or NaN coordinate, which has no
+// float literal, or nVerts if there is none
+static uint32_t FirstNonFiniteVertex(const mesh& m)
+{
+	for (uint32_t i = 0; i < m.nVerts; i++)
+		if (!std::isfinite(m.pX[i]) || !std::isfinite(m.pY[i]) || !std::isfinite(m.pZ[i]))
+			return i;
+	return m.nVerts;
+}
+
+// Text that reads back as exactly the same float, always with a
+// decimal point or exponent so the f suffix is valid
+static std::string FloatLiteral(float f)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.9g", f);
+	std::string s = buf;
+	if (s.find_first_of(".en") == std::string::npos)
+		s += ".0";
+	return s + "f";
+}
+
+static std::string VecLiteral(const vec3d& v)
+{
+	return "{ " + FloatLiteral(v.x) + ", " + FloatLiteral(v.y) + ", " + FloatLiteral(v.z) + ", " + FloatLiteral(v.w) + " }";
+}
+
+// Write the arrays of one mesh and return the initializer of its embeddedMesh
+static std::string WriteMesh(std::ofstream& out, const std::string& name, const mesh& m)
+{
+	// One array per position component, like the mesh stores them
+	const char* axes[3] = { "x", "y", "z" };
+	const float* streams[3] = { m.pX, m.pY, m.pZ };
+	for (int a = 0; a < 3; a++)
+	{
+		out << "constexpr float " << name << "_" << axes[a] << "[] = {\n";
+		for (uint32_t i = 0; i < m.nVerts; i++)
+			out << "\t" << FloatLiteral(streams[a][i]) << ",\n";
+		out << "};\n\n";
+	}
+
+	out << "constexpr vec3d " << name << "_planes[] = {\n";
+	for (uint32_t i = 0; i < m.nTris; i++)
+		out << "\t" << VecLiteral(m.pPlanes[i]) << ",\n";
+	out << "};\n\n";
+
+	out << "constexpr uint32_t " << name << "_indices[] = {\n";
+	for (uint32_t i = 0; i < m.nTris; i++)
+		out << "\t" << m.pIndices[3 * i] << ", " << m.pIndices[3 * i + 1] << ", " << m.pIndices[3 * i + 2] << ",\n";
+	out << "};\n\n";
+
+	return "{ " + name + "_x, " + name + "_y, " + name + "_z, " + name + "_planes, " + name + "_indices, " +
+		std::to_string(m.nVerts) + ", " + std::to_string(m.nTris) + ", " +
+		VecLiteral(m.vMin) + ", " + VecLiteral(m.vMax) + ", " + VecLiteral(m.vCentre) + ", " + FloatLiteral(m.fRadius) + " }";
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		std::cout << "Usage: obj2header file.obj out.h\n";
+		return 1;
+	}
+
+	std::string source = argv[1];
+	std::string header = argv[2];
+
+	// Name of the model: the file name without its directory and extension
+	std::string name = source.substr(source.find_last_of("/\\") + 1);
+	name = name.substr(0, name.find_last_of('.'));
+	for (char& c : name)
+		if (!isalnum((unsigned char)c))
+			c = '_';
+	if (name.empty() || isdigit((unsigned char)name[0]))
+		name = "_" + name;
+
+	ThreadPool pool;
+	mesh full;
+	std::vector<mesh> lods;
+	if (!full.Load(source, &pool) || full.nTris == 0)
+	{
+		std::cout << source << ": couldn't load object\n";
+		return 1;
+	}
+	uint32_t nBad = FirstNonFiniteVertex(full);
+	if (nBad < full.nVerts)
+	{
+		std::cout << source << ": a vertex isn't finite, which a header can't hold (" << full.pX[nBad] << " " << full.pY[nBad] << " " << full.pZ[nBad] << ")\n";
+		return 1;
+	}
+	Mesh_LoadLODs(source, full, lods);
+
+	MakeParentDirectories(header);
+	std::ofstream out(header, std::ios::binary);
+	if (!out)
+	{
+		std::cout << header << ": couldn't write header\n";
+		return 1;
+	}
+
+	out << "// Generated by tools/obj2header from " << source << ", do not edit\n";
+	out << "#pragma once\n\n";
+	out << "#include \"../MeshManager.h\"\n\n";
+	out << "namespace embedded\n{\n\n";
+
+	std::string fullInit = WriteMesh(out, name, full);
+	std::vector<std::string> lodInits;
+	for (size_t i = 0; i < lods.size(); i++)
+		lodInits.push_back(WriteMesh(out, name + "_lod" + std::to_string(i + 1), lods[i]));
+
+	if (!lodInits.empty())
+	{
+		out << "constexpr embeddedMesh " << name << "_lods[] = {\n";
+		for (auto& init : lodInits)
+			out << "\t" << init << ",\n";
+		out << "};\n\n";
+	}
+
+	out << "constexpr embeddedModel " << name << " = {\n\t" << fullInit << ",\n\t"
+		<< (lodInits.empty() ? "nullptr" : name + "_lods") << ", " << lodInits.size() << "\n};\n\n";
+	out << "}\n";
+
+	out.close();
+	if (!out)
+	{
+		std::cout << header << ": couldn't write header\n";
+		return 1;
+	}
+
+	std::cout << source << " -> " << header << " (" << full.nVerts << " vertices, " << full.nTris << " triangles, " << lods.size() << " levels of detail)\n";
+	return 0;
+}
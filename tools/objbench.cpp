@@ -0,0 +1,188 @@
+// Scaling of the chunked OBJ loader with the number of threads, on a synthetic
+// terrain written to a temporary file: a height field of about half as many
+// vertices as triangles, each row written just before the faces that use it,
+// as triangles and quads, plain, with v/vt/vn corners and with negative
+// (relative) indices. The file is deleted again at the end.
+//
+//   g++ -O2 -pthread tools/objbench.cpp -o objbench
+//   ./objbench [most threads] [triangles] [file]
+//
+//   cl /O2 /EHsc tools\objbench.cpp
+//
+// The defaults are every hardware thread, 10 million triangles and
+// objbench.obj, which is about 400 MB. Every load is checked to give exactly
+// the same mesh as the serial one, and any difference fails the run. A pool
+// of n threads works alongside the calling thread, which takes part in
+// ThreadPool::ParallelFor
+
+#include "../headers/Mesh.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+// Write a height field of about nTris triangles. Returns false if the file
+// can't be written
+bool WriteTerrain(const std::string& filename, uint64_t nTris)
+{
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (!f)
+		return false;
+
+	// nSide x nSide vertices make 2 (nSide - 1)^2 triangles
+	uint64_t nSide = (uint64_t)sqrt((double)nTris / 2.0) + 1;
+	if (nSide < 2)
+		nSide = 2;
+
+	std::string out;
+	char sz[256];
+	auto flush = [&](bool bAll)
+	{
+		if (out.size() > (1 << 20) || bAll)
+		{
+			fwrite(out.data(), 1, out.size(), f);
+			out.clear();
+		}
+	};
+	auto row = [&](uint64_t y)
+	{
+		for (uint64_t x = 0; x < nSide; x++)
+		{
+			float h = 4.0f * sinf(0.05f * (float)x) * cosf(0.07f * (float)y);
+			snprintf(sz, sizeof(sz), "v %.4f %.4f %.4f\n", (float)x * 0.5f, h, (float)y * 0.5f);
+			out += sz;
+		}
+	};
+
+	out += "# objbench terrain\n";
+	row(0);
+	for (uint64_t y = 0; y + 1 < nSide; y++)
+	{
+		row(y + 1);
+		int64_t nWritten = (int64_t)((y + 2) * nSide);	// Vertices so far, for negative indices
+		for (uint64_t x = 0; x + 1 < nSide; x++)
+		{
+			// Corners of the cell, 1 based
+			int64_t a = (int64_t)(y * nSide + x) + 1, b = a + 1;
+			int64_t c = a + (int64_t)nSide, d = c + 1;
+			switch ((x + y) % 4)
+			{
+			case 0:
+				snprintf(sz, sizeof(sz), "f %lld %lld %lld %lld\n", (long long)a, (long long)c, (long long)d, (long long)b);
+				break;
+			case 1:
+				snprintf(sz, sizeof(sz), "f %lld/1/1 %lld/2/1 %lld/3/1\nf %lld/1/1 %lld/3/1 %lld/4/1\n",
+					(long long)a, (long long)c, (long long)d, (long long)a, (long long)d, (long long)b);
+				break;
+			case 2:
+				a -= nWritten + 1; b -= nWritten + 1; c -= nWritten + 1; d -= nWritten + 1;
+				snprintf(sz, sizeof(sz), "f %lld %lld %lld\nf %lld %lld %lld\n",
+					(long long)a, (long long)c, (long long)d, (long long)a, (long long)d, (long long)b);
+				break;
+			default:
+				a -= nWritten + 1; b -= nWritten + 1; c -= nWritten + 1; d -= nWritten + 1;
+				snprintf(sz, sizeof(sz), "f %lld//1 %lld//1 %lld//1 %lld//1\n", (long long)a, (long long)c, (long long)d, (long long)b);
+				break;
+			}
+			out += sz;
+		}
+		flush(false);
+	}
+	flush(true);
+	bool bOk = ferror(f) == 0;
+	return fclose(f) == 0 && bOk;
+}
+
+// Same vertices, triangles and planes, bit for bit
+bool SameMesh(const mesh& a, const mesh& b)
+{
+	if (a.nVerts != b.nVerts || a.nTris != b.nTris)
+		return false;
+	return memcmp(a.pX, b.pX, sizeof(float) * a.nVerts) == 0 &&
+		memcmp(a.pY, b.pY, sizeof(float) * a.nVerts) == 0 &&
+		memcmp(a.pZ, b.pZ, sizeof(float) * a.nVerts) == 0 &&
+		memcmp(a.pIndices, b.pIndices, sizeof(uint32_t) * 3 * (size_t)a.nTris) == 0 &&
+		memcmp(a.pPlanes, b.pPlanes, sizeof(vec3d) * (size_t)a.nTris) == 0;
+}
+
+// Best of a few loads, in milliseconds. The last one is left in m
+double TimeLoad(const std::string& filename, ThreadPool* pool, mesh& m, bool& bLoaded)
+{
+	double fBest = 1e30;
+	bLoaded = true;
+	for (int run = 0; run < 3 && bLoaded; run++)
+	{
+		m = mesh();
+		auto tStart = std::chrono::steady_clock::now();
+		bLoaded = m.LoadFromObjectFile(filename, pool);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+		if (ms < fBest)
+			fBest = ms;
+	}
+	return fBest;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned nMaxThreads = argc > 1 ? (unsigned)atoi(argv[1]) : std::thread::hardware_concurrency();
+	if (nMaxThreads < 1)
+		nMaxThreads = 1;
+	uint64_t nTris = argc > 2 ? (uint64_t)atoll(argv[2]) : 10000000;
+	std::string filename = argc > 3 ? argv[3] : "objbench.obj";
+
+	std::cout << "Writing " << filename << "\n";
+	if (!WriteTerrain(filename, nTris))
+	{
+		std::cout << "Couldn't write " << filename << "\nFAILED\n";
+		return 1;
+	}
+
+	bool bOk = true, bLoaded;
+	mesh serial;
+	double fSerial = TimeLoad(filename, nullptr, serial, bLoaded);
+	if (!bLoaded)
+	{
+		std::cout << "Couldn't load " << filename << "\nFAILED\n";
+		remove(filename.c_str());
+		return 1;
+	}
+
+	uint64_t nBytes = 0;
+	uint64_t nTime;
+	GetFileStamp(filename, nBytes, nTime);
+	std::cout << serial.nVerts << " vertices, " << serial.nTris << " triangles, " << nBytes / (1024 * 1024) << " MB\n\n";
+	std::cout << "  threads      load ms   speedup\n";
+	std::cout << std::setw(9) << "serial" << std::setw(13) << std::fixed << std::setprecision(1) << fSerial
+		<< std::setw(10) << std::setprecision(2) << 1.0 << "\n";
+
+	for (unsigned nThreads = 1; nThreads <= nMaxThreads; nThreads++)
+	{
+		ThreadPool pool(nThreads);
+		mesh chunked;
+		double ms = TimeLoad(filename, &pool, chunked, bLoaded);
+		std::cout << std::setw(9) << nThreads << std::setw(13) << std::setprecision(1) << ms
+			<< std::setw(10) << std::setprecision(2) << fSerial / ms;
+		if (!bLoaded)
+		{
+			std::cout << "   failed to load";
+			bOk = false;
+		}
+		else if (!SameMesh(serial, chunked))
+		{
+			std::cout << "   differs from the serial load";
+			bOk = false;
+		}
+		std::cout << "\n";
+	}
+
+	remove(filename.c_str());
+	if (!bOk)
+	{
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,277 @@
+// Checks the half-space rasterizer against the scanline one and times both.
+// Build it twice to check the SSE and plain C++ versions agree (the coverage
+// hash printed at the end must match):
+//
+//   g++ -O2 tools/rasterbench.cpp -o rasterbench
+//   g++ -O2 -DHAMRO_NO_SIMD tools/rasterbench.cpp -o rasterbench_scalar
+//
+//   cl /O2 /EHsc tools\rasterbench.cpp
+//   cl /O2 /EHsc /DHAMRO_NO_SIMD tools\rasterbench.cpp /Ferasterbench_scalar.exe
+
+#include "../headers/Raster.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+
+const int WIDTH = 160;
+const int HEIGHT = 100;
+
+struct sCorner { float x, y; };
+
+// A screen of one byte cells plus depth, as the rasterizers see it
+struct sScreen
+{
+	std::vector<uint8_t> cells = std::vector<uint8_t>(WIDTH * HEIGHT);
+	std::vector<float> depth = std::vector<float>(WIDTH * HEIGHT);
+
+	rasterTarget<uint8_t> Target() { return { cells.data(), depth.data(), WIDTH, HEIGHT }; }
+
+	void Clear()
+	{
+		std::fill(cells.begin(), cells.end(), (uint8_t)0);
+		std::fill(depth.begin(), depth.end(), 0.0f);
+	}
+};
+
+// Distance from the centre of cell (x, y) to the nearest edge of the triangle
+static float EdgeDistance(const sCorner* c, int x, int y)
+{
+	float px = x + 0.5f, py = y + 0.5f;
+	float fBest = 1e30f;
+	for (int i = 0; i < 3; i++)
+	{
+		const sCorner& a = c[i];
+		const sCorner& b = c[(i + 1) % 3];
+		float dx = b.x - a.x, dy = b.y - a.y;
+		float t = ((px - a.x) * dx + (py - a.y) * dy) / (dx * dx + dy * dy + 1e-12f);
+		t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+		float ex = a.x + t * dx - px, ey = a.y + t * dy - py;
+		float d = sqrtf(ex * ex + ey * ey);
+		if (d < fBest)
+			fBest = d;
+	}
+	return fBest;
+}
+
+// Cover a triangle with the scanline rasterizer, corners rounded down to whole
+// cells the way hamroGraphics::FillTriangleDepth does
+static void ScanCover(const sCorner* c, sScreen& s)
+{
+	Raster_ScanTriangle(WIDTH, HEIGHT,
+		(int)floorf(c[0].x), (int)floorf(c[0].y),
+		(int)floorf(c[1].x), (int)floorf(c[1].y),
+		(int)floorf(c[2].x), (int)floorf(c[2].y),
+		[&](int sx, int ex, int y) { for (int x = sx; x <= ex; x++) s.cells[y * WIDTH + x] = 1; });
+}
+
+static void HalfSpaceCover(const sCorner* c, sScreen& s, uint8_t value = 1)
+{
+	Raster_HalfSpaceTriangle(s.Target(), c[0].x, c[0].y, 1.0f, c[1].x, c[1].y, 1.0f, c[2].x, c[2].y, 1.0f, value);
+}
+
+// Both rasterizers on random triangles, partly off screen. They differ only in
+// where they put the edges, the scanline one covering every cell an edge
+// passes through. Any cell covered by one but not the other must be next to an
+// edge, anything further in means a cell was wrongly filled or left out
+static bool CompareCoverage(uint64_t& nHash)
+{
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> pos(-40.0f, 200.0f);
+	std::uniform_real_distribution<float> size(1.0f, 60.0f);
+	sScreen scan, half;
+	long nBoth = 0, nScanOnly = 0, nHalfOnly = 0;
+	float fWorst = 0.0f;
+
+	for (int n = 0; n < 20000; n++)
+	{
+		sCorner c[3];
+		float cx = pos(rng), cy = pos(rng) * 0.6f, r = size(rng);
+		std::uniform_real_distribution<float> off(-r, r);
+		for (auto& p : c)
+			p = { cx + off(rng), cy + off(rng) };
+
+		scan.Clear();
+		half.Clear();
+		ScanCover(c, scan);
+		HalfSpaceCover(c, half);
+
+		for (int y = 0; y < HEIGHT; y++)
+			for (int x = 0; x < WIDTH; x++)
+			{
+				int i = y * WIDTH + x;
+				nHash = (nHash ^ half.cells[i]) * 1099511628211ull;
+				if (scan.cells[i] && half.cells[i])
+					nBoth++;
+				else if (scan.cells[i] || half.cells[i])
+				{
+					(scan.cells[i] ? nScanOnly : nHalfOnly)++;
+					float d = EdgeDistance(c, x, y);
+					if (d > fWorst)
+						fWorst = d;
+				}
+			}
+	}
+
+	std::cout << "Coverage over 20000 triangles: " << nBoth << " cells by both, " << nScanOnly << " by scanline only, "
+		<< nHalfOnly << " by half-space only\n";
+	std::cout << "Furthest differing cell from an edge: " << std::setprecision(2) << fWorst << " cells\n";
+	return fWorst <= 1.5f;
+}
+
+// A jittered grid of triangles sharing edges, with corners off cell centres
+// and some exactly on them. The half-space rasterizer must cover every cell
+// inside the grid exactly once
+static bool CheckWatertight(uint64_t& nHash)
+{
+	const int N = 12;
+	const float CELL = 11.0f;
+	std::mt19937 rng(2);
+	std::uniform_real_distribution<float> jitter(-3.0f, 3.0f);
+	sCorner grid[N + 1][N + 1];
+	for (int j = 0; j <= N; j++)
+		for (int i = 0; i <= N; i++)
+		{
+			bool bEdge = i == 0 || j == 0 || i == N || j == N;
+			grid[j][i] = { 10.0f + i * CELL + (bEdge ? 0.0f : jitter(rng)), 5.0f + j * CELL * 0.7f + (bEdge ? 0.0f : jitter(rng)) };
+			if ((i + j) % 5 == 0)
+			{
+				grid[j][i].x = floorf(grid[j][i].x) + 0.5f;
+				grid[j][i].y = floorf(grid[j][i].y) + 0.5f;
+			}
+		}
+
+	std::vector<int> count(WIDTH * HEIGHT, 0);
+	sScreen s;
+	for (int j = 0; j < N; j++)
+		for (int i = 0; i < N; i++)
+		{
+			sCorner tris[2][3] = {
+				{ grid[j][i], grid[j][i + 1], grid[j + 1][i + 1] },
+				{ grid[j][i], grid[j + 1][i + 1], grid[j + 1][i] } };
+			for (auto& t : tris)
+			{
+				s.Clear();
+				HalfSpaceCover(t, s);
+				for (int k = 0; k < WIDTH * HEIGHT; k++)
+				{
+					count[k] += s.cells[k];
+					nHash = (nHash ^ s.cells[k]) * 1099511628211ull;
+				}
+			}
+		}
+
+	// Cells well inside the grid's outline
+	long nHoles = 0, nTwice = 0, nInside = 0;
+	for (int y = 7; y < 5 + (int)(N * CELL * 0.7f) - 2; y++)
+		for (int x = 12; x < 10 + (int)(N * CELL) - 2; x++)
+		{
+			int k = count[y * WIDTH + x];
+			nInside++;
+			nHoles += k == 0;
+			nTwice += k > 1;
+		}
+	std::cout << "Shared edges: " << nInside << " cells inside the grid, " << nHoles << " left out, " << nTwice << " covered twice\n";
+	return nHoles == 0 && nTwice == 0;
+}
+
+// Triangles a second, depth tested, for triangles on screen with corners up to
+// fSize cells from their centre. The scanline version runs the same depth
+// tested span loop as hamroGraphics::FillTriangle, without the virtual Draw call
+static void Time(float fSize)
+{
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> off(-fSize, fSize);
+	std::uniform_real_distribution<float> ux(fSize, WIDTH - fSize), uy(fSize, HEIGHT - fSize);
+	std::uniform_real_distribution<float> uz(0.1f, 1.0f);
+	const int N_TRIS = 4096;
+	std::vector<sCorner> corners(3 * N_TRIS);
+	std::vector<float> zs(3 * N_TRIS);
+	double fArea = 0.0;
+	for (int n = 0; n < N_TRIS; n++)
+	{
+		float cx = ux(rng), cy = uy(rng);
+		sCorner* c = &corners[3 * n];
+		for (int k = 0; k < 3; k++)
+		{
+			c[k] = { cx + off(rng), cy + off(rng) };
+			zs[3 * n + k] = uz(rng);
+		}
+		fArea += fabs((c[1].x - c[0].x) * (c[2].y - c[0].y) - (c[1].y - c[0].y) * (c[2].x - c[0].x)) * 0.5;
+	}
+
+	sScreen s;
+	auto scan = [&](int n)
+	{
+		const sCorner* c = &corners[3 * n];
+		const float* z = &zs[3 * n];
+		int x1 = (int)floorf(c[0].x), y1 = (int)floorf(c[0].y);
+		int x2 = (int)floorf(c[1].x), y2 = (int)floorf(c[1].y);
+		int x3 = (int)floorf(c[2].x), y3 = (int)floorf(c[2].y);
+		float fDzDx = 0.0f, fDzDy = 0.0f;
+		int nDet = (x2 - x1) * (y3 - y1) - (x3 - x1) * (y2 - y1);
+		if (nDet != 0)
+		{
+			fDzDx = ((z[1] - z[0]) * (y3 - y1) - (z[2] - z[0]) * (y2 - y1)) / nDet;
+			fDzDy = ((z[2] - z[0]) * (x2 - x1) - (z[1] - z[0]) * (x3 - x1)) / nDet;
+		}
+		Raster_ScanTriangle(WIDTH, HEIGHT, x1, y1, x2, y2, x3, y3, [&](int sx, int ex, int y)
+			{
+				float zc = z[0] + fDzDx * (sx - x1) + fDzDy * (y - y1);
+				for (int x = sx; x <= ex; x++, zc += fDzDx)
+					if (zc > s.depth[y * WIDTH + x])
+					{
+						s.depth[y * WIDTH + x] = zc;
+						s.cells[y * WIDTH + x] = (uint8_t)n;
+					}
+			});
+	};
+	auto half = [&](int n)
+	{
+		const sCorner* c = &corners[3 * n];
+		const float* z = &zs[3 * n];
+		Raster_HalfSpaceTriangle(s.Target(), c[0].x, c[0].y, z[0], c[1].x, c[1].y, z[1], c[2].x, c[2].y, z[2], (uint8_t)n);
+	};
+
+	auto best = [&](auto fn)
+	{
+		double fBest = 1e30;
+		for (int run = 0; run < 5; run++)
+		{
+			s.Clear();
+			auto tStart = std::chrono::steady_clock::now();
+			for (int n = 0; n < N_TRIS; n++)
+				fn(n);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+			if (seconds < fBest)
+				fBest = seconds;
+		}
+		return N_TRIS / fBest / 1e6;
+	};
+	double fScan = best(scan);
+	double fHalf = best(half);
+	std::cout << "Area " << std::setw(6) << std::fixed << std::setprecision(1) << fArea / N_TRIS << " cells: "
+		<< std::setprecision(2) << "scanline " << std::setw(7) << fScan << " M/s, half-space " << std::setw(7) << fHalf << " M/s\n";
+}
+
+int main()
+{
+	std::cout << "Rasterizers, " << (HAMRO_SIMD ? "SSE" : "plain C++") << " half-space\n";
+
+	uint64_t nHash = 1469598103934665603ull;
+	bool bCoverage = CompareCoverage(nHash);
+	bool bWatertight = CheckWatertight(nHash);
+	std::cout << "Coverage hash " << std::hex << nHash << std::dec << "\n";
+
+	Time(2.0f);
+	Time(8.0f);
+	Time(30.0f);
+
+	if (!bCoverage || !bWatertight)
+	{
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,285 @@
+// Scaling of the tile binned rasterizer with the number of threads, on the
+// airplane alone and on the airplane over the mountains, drawn 800 x 450 like
+// main.cpp. Run it from the repository root so it finds the models:
+//
+//   g++ -O2 -pthread tools/tilebench.cpp -o tilebench
+//   ./tilebench [most threads]
+//
+//   cl /O2 /EHsc tools\tilebench.cpp
+//
+// Each frame is checked to come out the same with every number of threads.
+// Alongside the measured times it prints how much faster the frame could get
+// with that many threads given how the work is spread over the tiles, timing
+// each tile on one thread and handing them out in order to whichever thread
+// is free first, like ThreadPool::ParallelFor. That is the most the tiles
+// allow, whatever the machine
+
+#include "../headers/Matrix.h"
+#include "../headers/Transform.h"
+#include "../headers/Tiles.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+const int WIDTH = 800;
+const int HEIGHT = 450;
+
+class TileBench : private Matrix
+{
+public:
+	explicit TileBench(unsigned nMaxThreads) : m_nMaxThreads(nMaxThreads), m_pool(nMaxThreads > 1 ? nMaxThreads - 1 : 1)
+	{
+		m_matProj = Matrix_Projection(90.0f, (float)HEIGHT / (float)WIDTH, 0.1f, 1000.0f);
+	}
+
+	bool Run()
+	{
+		mesh airbus, mountains;
+		if (!airbus.Load("resources/airbus.obj") || !mountains.Load("resources/mountains.obj"))
+		{
+			std::cout << "Couldn't load resources/airbus.obj and resources/mountains.obj\n";
+			return false;
+		}
+
+		// The airplane as renderAirplane draws it
+		std::vector<triangle> vecAirbus;
+		matRigid matWorld = Matrix_MultiplyMatrix(Matrix_RotationY(0.9f), Matrix_Translation(0.0f, 0.0f, 2.0f));
+		Project(airbus, matWorld, true, vecAirbus);
+
+		// The airplane over the mountains as renderAirplaneMountains draws them
+		std::vector<triangle> vecPlane, vecMountains;
+		Project(mountains, Matrix_Translation(0.0f, -8.0f, 2.0f), true, vecMountains);
+		matWorld = Matrix_Identity();
+		matWorld.m[1][1] = -1.0f;
+		matWorld = Matrix_MultiplyMatrix(matWorld, Matrix_RotationY(1.8f));
+		matWorld = Matrix_MultiplyMatrix(matWorld, Matrix_Translation(0.0f, 0.0f, 2.0f));
+		Project(airbus, matWorld, false, vecPlane);
+
+		std::cout << "Tiles of " << tileBins::TILE_WIDTH << " x " << tileBins::TILE_HEIGHT << " cells, up to "
+			<< m_nMaxThreads << " threads, " << (HAMRO_SIMD ? "SSE" : "plain C++") << " half-space\n";
+		bool bOk = true;
+		for (int r = 0; r < 2; r++)
+		{
+			bool bHalfSpace = r == 1;
+			bOk &= Scene("Airplane", bHalfSpace, { &vecAirbus });
+			bOk &= Scene("Airplane and mountains", bHalfSpace, { &vecPlane, &vecMountains });
+		}
+		return bOk;
+	}
+
+private:
+	unsigned m_nMaxThreads;
+	ThreadPool m_pool;
+	matProjective m_matProj;
+	screenVerts m_screen;
+	tileBins m_tiles;
+	std::vector<uint8_t> m_cells = std::vector<uint8_t>(WIDTH * HEIGHT);
+	std::vector<float> m_depth = std::vector<float>(WIDTH * HEIGHT);
+
+	// Front facing triangles of m on screen, corners in cells with 1 / w in w,
+	// like ProjectMesh. There is no clipper here, so triangles crossing the near
+	// plane or reaching far off screen are left out, which none of these do
+	void Project(const mesh& m, const matRigid& matWorld, bool bFlipXY, std::vector<triangle>& vecOut)
+	{
+		float fFlip = bFlipXY ? -1.0f : 1.0f;
+		matProjective matToScreen = Matrix_MultiplyMatrix(matWorld, Matrix_MultiplyMatrix(m_matProj,
+			Matrix_Viewport(fFlip * 0.5f * WIDTH, 0.5f * WIDTH, fFlip * 0.5f * HEIGHT, 0.5f * HEIGHT)));
+		m_screen.Resize(m.nVerts);
+		Transform_Batch(matToScreen, m.pX, m.pY, m.pZ, m.nVerts, m_screen);
+
+		// The camera sits at the origin looking down z
+		vec3d vEyeLocal = Matrix_MultiplyVector(Matrix_Inverse(matWorld), vec3d{ 0.0f, 0.0f, 0.0f });
+		float fFacing = Matrix_Determinant3x3(matWorld) < 0.0f ? -1.0f : 1.0f;
+		for (uint32_t iTri = 0; iTri < m.nTris; iTri++)
+		{
+			const vec3d& plane = m.pPlanes[iTri];
+			if (fFacing * (plane.x * vEyeLocal.x + plane.y * vEyeLocal.y + plane.z * vEyeLocal.z + plane.w) <= 0.0f)
+				continue;
+
+			triangle t;
+			bool bKeep = true;
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t i = m.pIndices[3 * iTri + k];
+				float w = m_screen.w[i];
+				t.p[k] = { m_screen.x[i], m_screen.y[i], m_screen.z[i], 1.0f / w };
+				bKeep &= w >= 0.1f && t.p[k].x > -256.0f && t.p[k].x < WIDTH + 256.0f && t.p[k].y > -256.0f && t.p[k].y < HEIGHT + 256.0f;
+			}
+			if (!bKeep)
+				continue;
+			t.shade = (uint8_t)(vecOut.size() % 255 + 1);
+			vecOut.push_back(t);
+		}
+	}
+
+	// Draw one tile's triangles, depth tested, the way hamroGraphics::FillTriangleDepth does
+	void DrawTile(int i, bool bHalfSpace)
+	{
+		rasterRect rc = m_tiles.Rect(i);
+		rasterTarget<uint8_t> target = { m_cells.data(), m_depth.data(), WIDTH, HEIGHT };
+		for (const triangle* pt : m_tiles.bins[i])
+		{
+			const triangle& t = *pt;
+			if (bHalfSpace)
+			{
+				Raster_HalfSpaceTriangle(target, rc, t.p[0].x, t.p[0].y, t.p[0].w, t.p[1].x, t.p[1].y, t.p[1].w,
+					t.p[2].x, t.p[2].y, t.p[2].w, t.shade);
+				continue;
+			}
+
+			int x1 = (int)floorf(t.p[0].x), y1 = (int)floorf(t.p[0].y);
+			int x2 = (int)floorf(t.p[1].x), y2 = (int)floorf(t.p[1].y);
+			int x3 = (int)floorf(t.p[2].x), y3 = (int)floorf(t.p[2].y);
+			float z1 = t.p[0].w, z2 = t.p[1].w, z3 = t.p[2].w;
+			float fMinZ = z1 < z2 ? z1 : z2; if (z3 < fMinZ) fMinZ = z3;
+			float fMaxZ = z1 > z2 ? z1 : z2; if (z3 > fMaxZ) fMaxZ = z3;
+			float fDzDx = 0.0f, fDzDy = 0.0f;
+			int nDet = (x2 - x1) * (y3 - y1) - (x3 - x1) * (y2 - y1);
+			if (nDet != 0)
+			{
+				fDzDx = ((z2 - z1) * (y3 - y1) - (z3 - z1) * (y2 - y1)) / (float)nDet;
+				fDzDy = ((z3 - z1) * (x2 - x1) - (z2 - z1) * (x3 - x1)) / (float)nDet;
+			}
+			Raster_ScanTriangle(rc, x1, y1, x2, y2, x3, y3, [&](int sx, int ex, int y)
+				{
+					float z = z1 + fDzDx * (float)(sx - x1) + fDzDy * (float)(y - y1);
+					for (int x = sx; x <= ex; x++, z += fDzDx)
+					{
+						float zCell = z < fMinZ ? fMinZ : (z > fMaxZ ? fMaxZ : z);
+						if (zCell > m_depth[y * WIDTH + x])
+						{
+							m_depth[y * WIDTH + x] = zCell;
+							m_cells[y * WIDTH + x] = t.shade;
+						}
+					}
+				});
+		}
+	}
+
+	void Clear()
+	{
+		std::fill(m_cells.begin(), m_cells.end(), (uint8_t)0);
+		std::fill(m_depth.begin(), m_depth.end(), 0.0f);
+	}
+
+	uint64_t Hash() const
+	{
+		uint64_t nHash = 1469598103934665603ull;
+		for (uint8_t c : m_cells)
+			nHash = (nHash ^ c) * 1099511628211ull;
+		return nHash;
+	}
+
+	// Best of a few runs of fn, in milliseconds, each after an untimed setup()
+	template<class S, class F>
+	static double Best(S setup, F fn)
+	{
+		double fBest = 1e30;
+		for (int run = 0; run < 15; run++)
+		{
+			setup();
+			auto tStart = std::chrono::steady_clock::now();
+			fn();
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+			if (ms < fBest)
+				fBest = ms;
+		}
+		return fBest;
+	}
+
+	bool Scene(const char* name, bool bHalfSpace, std::initializer_list<const std::vector<triangle>*> lists)
+	{
+		size_t nTris = 0;
+		for (auto* pList : lists)
+			nTris += pList->size();
+
+		double fBin = Best([]() {}, [&]()
+			{
+				m_tiles.Clear(WIDTH, HEIGHT);
+				for (auto* pList : lists)
+					m_tiles.Add(*pList);
+			});
+		size_t nEntries = 0;
+		for (auto& bin : m_tiles.bins)
+			nEntries += bin.size();
+
+		// Each tile on its own, for the spread of work over them
+		std::vector<double> tileTimes(m_tiles.Count(), 1e30);
+		for (int run = 0; run < 15; run++)
+		{
+			Clear();
+			for (int i = 0; i < m_tiles.Count(); i++)
+			{
+				auto tStart = std::chrono::steady_clock::now();
+				DrawTile(i, bHalfSpace);
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+				if (ms < tileTimes[i])
+					tileTimes[i] = ms;
+			}
+		}
+		double fWork = 0.0;
+		for (double ms : tileTimes)
+			fWork += ms;
+
+		std::cout << "\n" << name << ", " << (bHalfSpace ? "half-space" : "scanline") << ": " << nTris << " triangles, "
+			<< std::fixed << std::setprecision(2) << (double)nEntries / nTris << " tiles each, binned in "
+			<< std::setprecision(3) << fBin << " ms\n";
+		std::cout << "  threads    raster ms   speedup   tile balance allows\n";
+
+		bool bOk = true;
+		uint64_t nFirstHash = 0;
+		double fOne = 0.0;
+		for (unsigned nThreads = 1; nThreads <= m_nMaxThreads; nThreads++)
+		{
+			double ms = Best([&]() { Clear(); }, [&]()
+				{
+					m_pool.ParallelFor(m_tiles.Count(), [&](size_t i) { DrawTile((int)i, bHalfSpace); }, nThreads);
+				});
+			if (nThreads == 1)
+			{
+				fOne = ms;
+				nFirstHash = Hash();
+			}
+			else if (Hash() != nFirstHash)
+			{
+				std::cout << "  " << nThreads << " threads drew a different frame\n";
+				bOk = false;
+			}
+
+			// Hand the timed tiles out in order to whichever thread is free first
+			std::vector<double> busy(nThreads, 0.0);
+			for (double t : tileTimes)
+			{
+				size_t iFree = 0;
+				for (size_t k = 1; k < busy.size(); k++)
+					if (busy[k] < busy[iFree])
+						iFree = k;
+				busy[iFree] += t;
+			}
+			double fSpan = 0.0;
+			for (double t : busy)
+				if (t > fSpan)
+					fSpan = t;
+
+			std::cout << std::setw(9) << nThreads << std::setw(13) << std::setprecision(3) << ms
+				<< std::setw(10) << std::setprecision(2) << fOne / ms << std::setw(22) << fWork / fSpan << "\n";
+		}
+		return bOk;
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	unsigned nMaxThreads = argc > 1 ? (unsigned)atoi(argv[1]) : std::thread::hardware_concurrency();
+	if (nMaxThreads < 1)
+		nMaxThreads = 1;
+
+	TileBench bench(nMaxThreads);
+	if (!bench.Run())
+	{
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	return 0;
+}